@@ -5,35 +5,152 @@
 #error "This header is only for C++"
 #endif
 
+#include <initializer_list>
+
+#include "critical_bitfield.hpp"
 #include "critical_data.hpp"
+#include "critical_journal.hpp"
+#include "critical_record.hpp"
+#include "scrub.hpp"
+
+// Declare a protected variable of type P with three replicas, the arguments
+// after the name are forwarded to the constructor of every copy. The variable
+// is registered with the background scrubber and gets its own telemetry counters.
+#define BACKUP_AS(P, x, ...) \
+__attribute__((section(BACKUP_SECTION_PRIMARY))) constinit P x{__VA_ARGS__}; \
+__attribute__((section(BACKUP_SECTION_BACKUP1))) constinit P x##_backup1{__VA_ARGS__}; \
+__attribute__((section(BACKUP_SECTION_BACKUP2))) constinit P x##_backup2{__VA_ARGS__}; \
+__attribute__((section(BACKUP_SECTION_BACKUP3))) constinit P x##_backup3{__VA_ARGS__}; \
+TELEMETRY(x); \
+SCRUB_REGISTER(x, backup_scrub(x, x##_backup1, x##_backup2, x##_backup3, x##_telemetry))
+
+// Every copy is a constant initialized image of the optional default value,
+// restored from flash by the bootstrap code on power-on
+#define BACKUP(T, x, ...) BACKUP_AS(critical_data<T>, x, critical_image, T{__VA_ARGS__})
+
+// Bring every replica in line with the primary copy, only those that differ are written,
+// returns the number of replicas written
+template<typename P>
+uint32_t backup_replicate(const P& x, P& backup1, P& backup2, P& backup3) noexcept
+{
+    uint32_t written = 0;
+    for (P* backup : { &backup1, &backup2, &backup3 })
+        if (!backup->same_as(x))
+        {
+            backup->clone(x);
+            ++written;
+        }
+    return written;
+}
+
+// Restore the primary copy from the replicas, two that agree win over the first valid one.
+// Every replica is verified in full, false when none of them is valid.
+template<typename P>
+bool backup_restore(P& x, const P& backup1, const P& backup2, const P& backup3) noexcept
+{
+    const P* const replicas[] = { &backup1, &backup2, &backup3 };
+    const bool valid[] = { backup1.verify(), backup2.verify(), backup3.verify() };
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = i + 1; j < 3; ++j)
+            if (valid[i] && valid[j] && replicas[i]->same_as(*replicas[j]))
+            {
+                x.clone(*replicas[i]);
+                return true;
+            }
+    for (size_t i = 0; i < 3; ++i)
+        if (valid[i])
+        {
+            x.clone(*replicas[i]);
+            return true;
+        }
+    return false;
+}
+
+// Full check of the primary copy whatever its trust window, restored from the replicas when it
+// fails. Needed before the primary is copied over the replicas or a write keeps part of it.
+template<typename P>
+bool backup_verify(P& x, const P& backup1, const P& backup2, const P& backup3, telemetry_counters& telemetry) noexcept
+{
+    if (x.verify())
+        return true;
+    ++telemetry.primary_invalid;
+    if (!backup_restore(x, backup1, backup2, backup3))
+        return false;
+    ++telemetry.replica_used;
+    ++telemetry.repair_writes;
+    return true;
+}
+
+// Restore the primary copy if it is invalid and repair the replicas, when no copy is valid
+// they are all left as they are. The trust window is enough to read the primary copy but not
+// to copy it over the replicas, it is verified in full before any of them is written.
+template<typename P>
+void backup_sync(P& x, P& backup1, P& backup2, P& backup3, telemetry_counters& telemetry) noexcept
+{
+    if (backup1.same_as(x) && backup2.same_as(x) && backup3.same_as(x) && x.is_valid())
+        return;
+    if (backup_verify(x, backup1, backup2, backup3, telemetry))
+        telemetry.repair_writes += backup_replicate(x, backup1, backup2, backup3);
+}
+
+// Background check of every copy, the primary one is verified in full whatever its
+// trust window and the replicas are compared against it
+template<typename P>
+scrub_result_t backup_scrub(P& x, P& backup1, P& backup2, P& backup3, telemetry_counters& telemetry) noexcept
+{
+    uint32_t written = 0;
+    if (!x.verify())
+    {
+        ++telemetry.primary_invalid;
+        if (!backup_restore(x, backup1, backup2, backup3))
+            return SCRUB_LOST;
+        ++telemetry.replica_used;
+        ++written;
+    }
+    written += backup_replicate(x, backup1, backup2, backup3);
+    telemetry.repair_writes += written;
+    return written != 0 ? SCRUB_REPAIRED : SCRUB_CLEAN;
+}
 
-#define BACKUP(T, x) \
-__attribute__((section(".critical"))) critical_data<T> x; \
-__attribute__((section(".backup1"))) critical_data<T> x##_backup1; \
-__attribute__((section(".backup2"))) critical_data<T> x##_backup2; \
-__attribute__((section(".backup3"))) critical_data<T> x##_backup3
+// Counts a variable found with no valid copy, the caller then sets it back to its default.
+// The only place a loss is counted, a sync or a scrub that finds one leaves it to this check.
+template<typename P>
+bool backup_is_valid(const P& x, const P& backup1, const P& backup2, const P& backup3, telemetry_counters& telemetry) noexcept
+{
+    if (x.is_valid() || backup1.is_valid() || backup2.is_valid() || backup3.is_valid())
+        return true;
+    ++telemetry.all_invalid;
+    return false;
+}
+
+#define BACKUP_SYNC(x) \
+backup_sync(x, x##_backup1, x##_backup2, x##_backup3, x##_telemetry)
 
 #define BACKUP_GET(x, y) \
-do { \
-if (x.is_valid()) x = x; \
-else if (x##_backup1.is_valid()) x = x##_backup1; \
-else if (x##_backup2.is_valid()) x = x##_backup2; \
-else if (x##_backup3.is_valid()) x = x##_backup3; \
-x##_backup1 = x; \
-x##_backup2 = x; \
-x##_backup3 = x; \
-} while (0); \
+BACKUP_SYNC(x); \
 y = x.get()
 
-#define BACKUP_SET(x, y) \
+#define BACKUP_FIELD_GET(x, i, y) \
+BACKUP_SYNC(x); \
+y = x.get<i>()
+
+// Set a critical_data value, or every field of a critical_record at once
+#define BACKUP_SET(x, ...) \
 do { \
-x.set(y); \
-x##_backup1 = x; \
-x##_backup2 = x; \
-x##_backup3 = x; \
+x.set(__VA_ARGS__); \
+backup_replicate(x, x##_backup1, x##_backup2, x##_backup3); \
+} while (0)
+
+// The other fields are kept, so the primary copy is verified and repaired before the write.
+// A write dropped because no copy passes leaves the replicas alone.
+#define BACKUP_FIELD_SET(x, i, y) \
+do { \
+backup_verify(x, x##_backup1, x##_backup2, x##_backup3, x##_telemetry); \
+if (x.set<i>(y)) \
+backup_replicate(x, x##_backup1, x##_backup2, x##_backup3); \
 } while (0)
 
 #define BACKUP_IS_VALID(x) \
-(x.is_valid() || x##_backup1.is_valid() || x##_backup2.is_valid() || x##_backup3.is_valid())
+backup_is_valid(x, x##_backup1, x##_backup2, x##_backup3, x##_telemetry)
 
-#endif
\ No newline at end of file
+#endif
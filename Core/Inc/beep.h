@@ -7,13 +7,33 @@ extern "C" {
 
 #include "stm32f4xx_hal.h"
 
+// Actual defined in main.c, counts microseconds
+extern TIM_HandleTypeDef htim6;
+
 void BEEP_SwitchMode(uint8_t mode);
 
 #define BEEP_MODE_OFF   GPIO_PIN_RESET
 #define BEEP_MODE_ON    GPIO_PIN_SET
 
+// Tone of the patterns, the 2ms on 2ms off of the old busy loop
+#define BEEP_TONE_HZ    250
+
+typedef enum
+{
+    BEEP_PATTERN_CONTINUOUS,    // one steady tone
+    BEEP_PATTERN_PULSED,        // 100ms tone, 100ms pause
+    BEEP_PATTERN_ESCALATING,    // pulses rising in pitch over four steps, then again from the lowest
+} BEEP_Pattern;
+
+// All of them return at once, the TIM6 interrupt toggles the pin from then on
+void BEEP_Start(uint32_t frequency);
+// Plays for duration_ms, 0 plays until BEEP_Stop
+void BEEP_Play(BEEP_Pattern pattern, uint32_t duration_ms);
+void BEEP_Stop(void);
+uint8_t BEEP_IsPlaying(void);
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
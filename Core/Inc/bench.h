@@ -0,0 +1,31 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+// One shot micro benchmarks, results are left in BENCH_* globals for the debugger.
+// Only does anything when built with BENCHMARK, main runs them after a cold boot only.
+void BENCH_Run(void);
+
+// Boot cost, Boostrap() runs on the 16MHz HSI after a cold boot and on the 168MHz PLL
+// after a warm one, SM_Init() always on the PLL. service_cycles runs from main to the
+// first SM_Run, the startup code before main is not counted.
+typedef struct
+{
+    uint32_t warm;
+    uint32_t main_cycles; // the cycle counter at the start of main
+    uint32_t bootstrap_cycles;
+    uint32_t sm_init_cycles;
+    uint32_t service_cycles;
+} BENCH_BootResult;
+extern BENCH_BootResult BENCH_Boot;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
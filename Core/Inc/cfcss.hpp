@@ -0,0 +1,85 @@
+#ifndef __CFCSS_HPP
+#define __CFCSS_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "critical_data.hpp"
+
+// Compile time signature of node i of a control flow graph. A bijection of the index
+// with every output bit depending on every input bit, so no two nodes share one and
+// signatures of neighbouring indices are far apart.
+constexpr uint32_t cfcss_signature(uint32_t node) noexcept
+{
+    uint32_t x = node + 0x9E3779B9;
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+template<size_t N>
+constexpr std::array<uint32_t, N> cfcss_signatures() noexcept
+{
+    std::array<uint32_t, N> signatures{};
+    for (size_t i = 0; i < N; ++i)
+        signatures[i] = cfcss_signature(i);
+    return signatures;
+}
+
+// Fewest bits that tell two of the signatures apart
+template<size_t N>
+constexpr int cfcss_min_distance(const std::array<uint32_t, N>& signatures) noexcept
+{
+    int distance = 32;
+    for (size_t i = 0; i < N; ++i)
+        for (size_t j = i + 1; j < N; ++j)
+            distance = std::min(distance, std::popcount(signatures[i] ^ signatures[j]));
+    return distance;
+}
+
+// Runtime signature G of CFCSS control flow checking. A node checks on entry that G holds
+// its own signature and on exit folds the edge to the next node into G with one xor. With
+// several predecessors per node, the run-time adjusting signature D of CFCSS is the whole
+// edge difference, so a jump into any node but the one the exit chose fails its check.
+// G is kept with its complement, a corrupted register fails the check like a wrong jump.
+class cfcss_register final
+{
+public:
+    // Skip initialization for static objects
+    explicit cfcss_register() noexcept {}
+    constexpr cfcss_register(critical_image_t, uint32_t signature) noexcept
+        : signature_(signature), complement_(~signature)
+    {
+    }
+    ~cfcss_register() noexcept {}
+
+    bool check(uint32_t signature) const noexcept
+    {
+        const uint32_t current = signature_;
+        return current == signature && complement_ == ~current;
+    }
+    void update(uint32_t difference) noexcept
+    {
+        signature_ = signature_ ^ difference;
+        complement_ = complement_ ^ difference;
+    }
+    void reset(uint32_t signature) noexcept
+    {
+        signature_ = signature;
+        complement_ = ~signature;
+    }
+
+private:
+    volatile uint32_t signature_;
+    volatile uint32_t complement_;
+};
+
+#endif
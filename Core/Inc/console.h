@@ -0,0 +1,30 @@
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+// Longest line CONSOLE_Printf sends, longer ones are cut
+#define CONSOLE_LINE_SIZE 96
+
+// Single character commands over USART1, polled from the idle slots of the
+// state machine so a command never interrupts a state
+void CONSOLE_Poll(void);
+// Blocking formatted output on USART1
+void CONSOLE_Printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+// Command handlers, defined next to the data they print
+void TELEMETRY_Dump(void);
+void TRACE_Dump(void);
+#ifdef BENCHMARK
+void SM_ProfileDump(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
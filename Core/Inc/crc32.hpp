@@ -0,0 +1,117 @@
+#ifndef __CRC32_HPP
+#define __CRC32_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CRITICAL_DATA_HOST
+#include "stm32f4xx_hal.h"
+#include "stm32f4xx_hal_crc.h"
+
+extern "C" CRC_HandleTypeDef hcrc;
+#endif
+
+// CRC policies for critical_data, all of them produce the result of the STM32 CRC unit:
+// CRC-32/MPEG-2, polynomial 0x04C11DB7, initial value 0xFFFFFFFF, fed one word at a time,
+// most significant bit first, no reflection and no final xor.
+constexpr uint32_t CRC32_POLYNOMIAL = 0x04C11DB7;
+constexpr uint32_t CRC32_INITIAL = 0xFFFFFFFF;
+
+#ifndef CRITICAL_DATA_HOST
+// Hardware CRC unit, the HAL resets the data register before each calculation
+template<size_t Slices>
+struct crc32_sw;
+
+struct crc32_hw final
+{
+    // Constant initialized images are calculated by the software crc
+    using image = crc32_sw<4>;
+
+    static uint32_t calculate(const volatile uint32_t* words, size_t count) noexcept
+    {
+        return HAL_CRC_Calculate(&hcrc, (uint32_t*)words, count);
+    }
+};
+#endif
+
+// Table driven software CRC, slicing by 4 handles one word per step and
+// slicing by 8 two words per step with twice the table size (4KB / 8KB of flash).
+// Usable in constant expressions as long as the input is not volatile.
+template<size_t Slices>
+struct crc32_sw final
+{
+    static_assert(Slices == 4 || Slices == 8);
+
+    using image = crc32_sw;
+
+    struct table_t
+    {
+        uint32_t entries[Slices][256];
+    };
+
+    static constexpr table_t make_table() noexcept
+    {
+        table_t table{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i << 24;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 0x80000000) ? (crc << 1) ^ CRC32_POLYNOMIAL : (crc << 1);
+            table.entries[0][i] = crc;
+        }
+        // entries[k][i] is the crc of byte i followed by k zero bytes
+        for (size_t k = 1; k < Slices; ++k)
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                const uint32_t prev = table.entries[k - 1][i];
+                table.entries[k][i] = (prev << 8) ^ table.entries[0][prev >> 24];
+            }
+        return table;
+    }
+
+    static constexpr table_t table = make_table();
+
+    static constexpr uint32_t step(uint32_t crc, uint32_t word) noexcept
+    {
+        const auto& t = table.entries;
+        crc ^= word;
+        return t[3][crc >> 24] ^ t[2][(crc >> 16) & 0xFF] ^ t[1][(crc >> 8) & 0xFF] ^ t[0][crc & 0xFF];
+    }
+
+    template<typename Word>
+    static constexpr uint32_t calculate(const Word* words, size_t count) noexcept
+    {
+        uint32_t crc = CRC32_INITIAL;
+        size_t i = 0;
+        if constexpr (Slices == 8)
+        {
+            const auto& t = table.entries;
+            for (; i + 2 <= count; i += 2)
+            {
+                const uint32_t hi = crc ^ words[i];
+                const uint32_t lo = words[i + 1];
+                crc = t[7][hi >> 24] ^ t[6][(hi >> 16) & 0xFF] ^ t[5][(hi >> 8) & 0xFF] ^ t[4][hi & 0xFF]
+                    ^ t[3][lo >> 24] ^ t[2][(lo >> 16) & 0xFF] ^ t[1][(lo >> 8) & 0xFF] ^ t[0][lo & 0xFF];
+            }
+        }
+        for (; i < count; ++i)
+            crc = step(crc, words[i]);
+        return crc;
+    }
+};
+
+// Reference value of the CRC unit for a single 0x12345678 word
+static_assert([] { const uint32_t w[] = { 0x12345678 }; return crc32_sw<4>::calculate(w, 1); }() == 0xDF8A8A2B);
+static_assert([] { const uint32_t w[] = { 1, 2, 3 }; return crc32_sw<8>::calculate(w, 3); }() == 0x64C51784);
+
+#ifdef CRITICAL_DATA_HOST
+using crc32_default = crc32_sw<8>;
+#else
+using crc32_default = crc32_hw;
+#endif
+
+#endif
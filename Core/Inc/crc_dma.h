@@ -0,0 +1,30 @@
+#ifndef __CRC_DMA_H
+#define __CRC_DMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+// Word aligned memory range [start, end) to checksum
+typedef struct
+{
+    const volatile void* start;
+    const volatile void* end;
+} CRC_DMA_Range;
+
+// Checksum several ranges as one stream by feeding them into the CRC data register
+// with DMA2 memory to memory transfers, the CPU is free while they run. The ranges
+// must stay alive and the CRC unit must not be used by anything else until the
+// result has been collected. The result equals HAL_CRC_Calculate over the same words.
+HAL_StatusTypeDef CRC_DMA_Start(const CRC_DMA_Range* ranges, uint32_t count);
+uint8_t CRC_DMA_IsBusy(void);
+// Sleep until the transfers are done and collect the result
+HAL_StatusTypeDef CRC_DMA_Wait(uint32_t* crc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __CRITICAL_BITFIELD_HPP
+#define __CRITICAL_BITFIELD_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <utility>
+
+#include "critical_data.hpp"
+
+// Layout of several small fields packed into one word, field I is Widths[I] bits
+// wide and placed right after field I - 1, starting from bit 0
+template<size_t... Widths>
+struct bitfield final
+{
+    static_assert(((Widths > 0) && ...));
+    static_assert((Widths + ...) <= 32);
+
+    static constexpr size_t field_count = sizeof...(Widths);
+
+    template<size_t I>
+    static constexpr uint32_t width() noexcept
+    {
+        constexpr size_t widths[] = { Widths... };
+        return widths[I];
+    }
+
+    template<size_t I>
+    static constexpr uint32_t offset() noexcept
+    {
+        constexpr size_t widths[] = { Widths... };
+        uint32_t result = 0;
+        for (size_t i = 0; i < I; ++i)
+            result += widths[i];
+        return result;
+    }
+
+    template<size_t I>
+    static constexpr uint32_t mask() noexcept
+    {
+        return (width<I>() == 32 ? 0xFFFFFFFFu : (1u << width<I>()) - 1) << offset<I>();
+    }
+
+    // Values wider than their field are truncated
+    template<size_t I>
+    static constexpr uint32_t get(uint32_t word) noexcept
+    {
+        return (word & mask<I>()) >> offset<I>();
+    }
+
+    template<size_t I>
+    static constexpr uint32_t with(uint32_t word, uint32_t value) noexcept
+    {
+        return (word & ~mask<I>()) | ((value << offset<I>()) & mask<I>());
+    }
+
+    template<typename... Vs>
+    static constexpr uint32_t pack(Vs... values) noexcept
+    {
+        static_assert(sizeof...(Vs) == field_count);
+        return pack(std::make_index_sequence<field_count>{}, static_cast<uint32_t>(values)...);
+    }
+
+private:
+    template<size_t... Is, typename... Vs>
+    static constexpr uint32_t pack(std::index_sequence<Is...>, Vs... values) noexcept
+    {
+        return (with<Is>(0, values) | ...);
+    }
+};
+
+static_assert(bitfield<1, 3, 1, 20>::pack(1u, 5u, 1u, 999999u) == (1u | 5u << 1 | 1u << 4 | 999999u << 5));
+static_assert(bitfield<1, 3, 1, 20>::get<3>(bitfield<1, 3, 1, 20>::pack(1u, 5u, 1u, 999999u)) == 999999u);
+
+// Small state flags packed into a single protected word, with the interface of a
+// critical_record so the BACKUP field macros work on it. Every update of one field
+// or of all of them costs one crc calculation over one word.
+template<typename Crc, size_t... Widths>
+class basic_critical_bitfield final
+{
+public:
+    using layout = bitfield<Widths...>;
+
+    template<size_t I>
+    using field_type = uint32_t;
+
+    static constexpr size_t word_count = 1;
+
+    // Skip crc calculate for static initializations
+    explicit basic_critical_bitfield() noexcept {}
+    template<typename... Vs>
+    constexpr basic_critical_bitfield(critical_image_t, Vs... values) noexcept;
+    ~basic_critical_bitfield() noexcept {};
+
+    template<size_t I>
+    uint32_t get() const noexcept;
+    // False when the word fails its check and the write is dropped
+    template<size_t I>
+    bool set(uint32_t value) noexcept;
+    template<typename... Vs>
+    void set(Vs... values) noexcept;
+    bool is_valid() const noexcept;
+    bool verify() const noexcept;
+
+    // Compare or copy the word and crc as they are, for replicas of an already checked copy
+    bool same_as(const basic_critical_bitfield& other) const noexcept;
+    void clone(const basic_critical_bitfield& other) noexcept;
+
+    bool operator!() const noexcept;
+
+private:
+    critical_data<uint32_t, Crc> data_;
+};
+
+template<size_t... Widths>
+using critical_bitfield = basic_critical_bitfield<critical_check_default, Widths...>;
+
+template<typename Crc, size_t... Widths>
+template<typename... Vs>
+constexpr basic_critical_bitfield<Crc, Widths...>::basic_critical_bitfield(critical_image_t, Vs... values) noexcept
+    : data_(critical_image, layout::pack(values...))
+{
+}
+
+template<typename Crc, size_t... Widths>
+template<size_t I>
+uint32_t basic_critical_bitfield<Crc, Widths...>::get() const noexcept
+{
+    return layout::template get<I>(data_.get());
+}
+
+template<typename Crc, size_t... Widths>
+template<size_t I>
+bool basic_critical_bitfield<Crc, Widths...>::set(uint32_t value) noexcept
+{
+    // Same as a record field, the other fields must pass a full check or the write is dropped
+    if (!data_.verify())
+        return false;
+    data_.set(layout::template with<I>(data_.get(), value));
+    return true;
+}
+
+template<typename Crc, size_t... Widths>
+template<typename... Vs>
+void basic_critical_bitfield<Crc, Widths...>::set(Vs... values) noexcept
+{
+    data_.set(layout::pack(values...));
+}
+
+template<typename Crc, size_t... Widths>
+bool basic_critical_bitfield<Crc, Widths...>::is_valid() const noexcept
+{
+    return data_.is_valid();
+}
+
+template<typename Crc, size_t... Widths>
+bool basic_critical_bitfield<Crc, Widths...>::verify() const noexcept
+{
+    return data_.verify();
+}
+
+template<typename Crc, size_t... Widths>
+bool basic_critical_bitfield<Crc, Widths...>::same_as(const basic_critical_bitfield& other) const noexcept
+{
+    return data_.same_as(other.data_);
+}
+
+template<typename Crc, size_t... Widths>
+void basic_critical_bitfield<Crc, Widths...>::clone(const basic_critical_bitfield& other) noexcept
+{
+    data_.clone(other.data_);
+}
+
+template<typename Crc, size_t... Widths>
+bool basic_critical_bitfield<Crc, Widths...>::operator!() const noexcept
+{
+    return !is_valid();
+}
+
+#endif
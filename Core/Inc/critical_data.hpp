@@ -5,20 +5,202 @@
 #error "This header is only for C++"
 #endif
 
-#include "stm32f4xx_hal.h"
-#include "stm32f4xx_hal_crc.h"
+#include <array>
+#include <bit>
 
-extern "C" CRC_HandleTypeDef hcrc;
+#include "crc32.hpp"
+#include "secded.hpp"
 
-template<typename T>
+#ifdef BENCHMARK
+#include "dwt.h"
+#endif
+
+// Passes a verified variable is read without a check, 1 trusts it for the pass it was
+// verified or written in only
+#ifndef CRITICAL_TRUST_EPOCHS
+#define CRITICAL_TRUST_EPOCHS 1
+#endif
+static_assert(CRITICAL_TRUST_EPOCHS >= 1);
+
+// Validation epoch, advanced once per state machine pass. A variable that has
+// passed its CRC check is trusted for CRITICAL_TRUST_EPOCHS epochs, which only ever
+// spares a check on a read. Copying a primary over its replicas and writing one field
+// of several both verify in full first, so a flip inside the window is never spread.
+// Kept in .critical so that it survives resets together with the marks it guards,
+// it never becomes 0 so the 0 mark of a freshly restored image is never trusted.
+//
+// The marks are the 31 bit epoch with a parity bit on top and the epoch is kept with its
+// complement, so a single flip in either never makes a stale mark look current.
+struct critical_epoch final
+{
+    static constexpr uint32_t kEpochMask = 0x7FFFFFFF;
+
+    static constexpr uint32_t mark(uint32_t epoch) noexcept
+    {
+        return epoch | static_cast<uint32_t>(std::popcount(epoch) & 1) << 31;
+    }
+
+    // A corrupted epoch goes on from the larger of its two copies, never back to one
+    // that older marks may hold
+    static void advance() noexcept
+    {
+        const uint32_t value = value_ & kEpochMask;
+        const uint32_t complement = ~complement_ & kEpochMask;
+        const uint32_t next = (value > complement ? value : complement) + 1;
+        const uint32_t current = mark(next <= kEpochMask ? next : 1);
+        value_ = current;
+        complement_ = ~current;
+    }
+
+    // Mark of the current epoch, 0 while the epoch is corrupted so nothing is trusted
+    static uint32_t current() noexcept
+    {
+        const uint32_t value = value_;
+        return value == ~complement_ ? value : 0;
+    }
+
+    static bool trusted(uint32_t verified) noexcept
+    {
+        const uint32_t now = current();
+        if constexpr (CRITICAL_TRUST_EPOCHS == 1)
+            return verified != 0 && verified == now;
+        else
+            return verified != 0 && now != 0 && mark(verified & kEpochMask) == verified
+                && ((now - verified) & kEpochMask) < CRITICAL_TRUST_EPOCHS;
+    }
+
+    static volatile uint32_t value_;
+    static volatile uint32_t complement_;
+};
+
+// Tag for constant initialized images, whose crc is calculated by the compiler
+struct critical_image_t
+{
+    explicit critical_image_t() = default;
+};
+inline constexpr critical_image_t critical_image{};
+
+#ifdef BENCHMARK
+struct critical_stats final
+{
+    static inline uint32_t crc_runs;
+    static inline uint32_t crc_cycles;
+    static inline uint32_t cache_hits;
+    static inline uint32_t ecc_corrections;
+    static inline uint32_t writes;
+};
+#endif
+
+// Raw word access for replica synchronization, neither of them touches the crc unit
+inline bool critical_equal(const volatile uint32_t* a, const volatile uint32_t* b, size_t count) noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+inline void critical_copy(volatile uint32_t* dst, const volatile uint32_t* src, size_t count) noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = src[i];
+#ifdef BENCHMARK
+    ++critical_stats::writes;
+#endif
+}
+
+// Checksum and validation shared by every protected type
+template<typename Crc>
+struct critical_check final
+{
+    static uint32_t calculate(const volatile uint32_t* words, size_t count) noexcept
+    {
+#ifdef BENCHMARK
+        const uint32_t start = DWT_GetCycles();
+        const uint32_t result = Crc::calculate(words, count);
+        critical_stats::crc_cycles += DWT_GetCycles() - start;
+        ++critical_stats::crc_runs;
+        return result;
+#else
+        return Crc::calculate(words, count);
+#endif
+    }
+
+    // Error correcting policies only cover a limited number of words
+    template<size_t N>
+    static constexpr bool fits = []
+    {
+        if constexpr (requires { Crc::max_words; })
+            return N <= Crc::max_words;
+        else
+            return true;
+    }();
+
+    template<size_t N>
+    static constexpr uint32_t calculate_image(const std::array<uint32_t, N>& words) noexcept
+    {
+        return Crc::image::calculate(words.data(), N);
+    }
+
+    // Error correcting policies repair the words in place, the object itself is never const
+    static bool check(const volatile uint32_t* words, size_t count, const volatile uint32_t& crc) noexcept
+    {
+        if constexpr (requires { Crc::correct(nullptr, 0, (volatile uint32_t&)crc); })
+        {
+            const auto result = Crc::correct(const_cast<volatile uint32_t*>(words), count, const_cast<volatile uint32_t&>(crc));
+#ifdef BENCHMARK
+            if (result == Crc::ECC_CORRECTED)
+                ++critical_stats::ecc_corrections;
+#endif
+            return result != Crc::ECC_UNCORRECTABLE;
+        }
+        else
+            return crc == calculate(words, count);
+    }
+
+    static bool is_valid(const volatile uint32_t* words, size_t count, const volatile uint32_t& crc, volatile uint32_t& verified) noexcept
+    {
+#ifndef CRITICAL_DATA_NO_EPOCH
+        if (critical_epoch::trusted(verified))
+        {
+#ifdef BENCHMARK
+            ++critical_stats::cache_hits;
+#endif
+            return true;
+        }
+#endif
+        return verify(words, count, crc, verified);
+    }
+
+    // Full check regardless of the trust window, marks the words as verified now
+    static bool verify(const volatile uint32_t* words, size_t count, const volatile uint32_t& crc, volatile uint32_t& verified) noexcept
+    {
+        if (!check(words, count, crc))
+            return false;
+        verified = critical_epoch::current();
+        return true;
+    }
+};
+
+// Protection used when none is given, define CRITICAL_DATA_ECC to correct single bit flips
+#ifdef CRITICAL_DATA_ECC
+using critical_check_default = ecc_secded;
+#else
+using critical_check_default = crc32_default;
+#endif
+
+// Crc selects the checksum backend, see crc32.hpp and secded.hpp
+template<typename T, typename Crc = critical_check_default>
 class critical_data final
 {
 public:
     // Ensure that the size of the data type is a multiple of 4 bytes
     static_assert(sizeof(T) % sizeof(uint32_t) == 0);
+    static_assert(critical_check<Crc>::template fits<sizeof(T) / sizeof(uint32_t)>);
 
     // Skip crc calculate for static initializations
     explicit critical_data() noexcept {}
+    constexpr critical_data(critical_image_t, const T& data) noexcept;
     explicit critical_data(const T& data) noexcept;
     explicit critical_data(T&& data) noexcept;
     explicit critical_data(const critical_data& other) noexcept;
@@ -33,8 +215,14 @@ public:
     volatile const T& get() const noexcept;
     void set(const T& data) noexcept;
     bool is_valid() const noexcept;
+    bool verify() const noexcept;
+
+    // Compare or copy data and crc as they are, for replicas of an already checked copy
+    bool same_as(const critical_data& other) const noexcept;
+    void clone(const critical_data& other) noexcept;
 
     uint32_t calculate_crc() const noexcept;
+    static constexpr uint32_t calculate_image_crc(const T& data) noexcept;
     uint32_t update_crc(uint32_t new_crc) const noexcept;
 
     bool operator!() const noexcept;
@@ -45,116 +233,176 @@ public:
 private:
     volatile T data_;
     volatile uint32_t crc_;
+    // Epoch in which the crc was last verified, writes through get() bypass it
+    mutable volatile uint32_t verified_;
 };
 
-template<typename T>
-critical_data<T>::critical_data(const T& data) noexcept
+template<typename T, typename Crc>
+constexpr critical_data<T, Crc>::critical_data(critical_image_t, const T& data) noexcept
+    : data_(data), crc_(calculate_image_crc(data)), verified_(0)
+{
+}
+
+template<typename T, typename Crc>
+critical_data<T, Crc>::critical_data(const T& data) noexcept
 {
     set((const T&)data);
 }
 
-template<typename T>
-critical_data<T>::critical_data(T&& data) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>::critical_data(T&& data) noexcept
 {
     set((const T&)data);
 }
 
-template<typename T>
-critical_data<T>::critical_data(const critical_data& other) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>::critical_data(const critical_data& other) noexcept
 {
     set((const T&)other.data_);
 }
 
-template<typename T>
-critical_data<T>::critical_data(critical_data&& other) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>::critical_data(critical_data&& other) noexcept
 {
     set((const T&)other.data_);
 }
 
-template<typename T>
-critical_data<T>& critical_data<T>::operator=(const T& data) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>& critical_data<T, Crc>::operator=(const T& data) noexcept
 {
     set((const T&)data);
     return *this;
 }
 
-template<typename T>
-critical_data<T>& critical_data<T>::operator=(T&& data) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>& critical_data<T, Crc>::operator=(T&& data) noexcept
 {
     set((const T&)data);
     return *this;
 }
 
-template<typename T>
-critical_data<T>& critical_data<T>::operator=(const critical_data& other) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>& critical_data<T, Crc>::operator=(const critical_data& other) noexcept
 {
     set((const T&)other.data_);
     return *this;
 }
 
-template<typename T>
-critical_data<T>& critical_data<T>::operator=(critical_data&& other) noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>& critical_data<T, Crc>::operator=(critical_data&& other) noexcept
 {
     set((const T&)other.data_);
     return *this;
 }
 
-template<typename T>
-uint32_t critical_data<T>::calculate_crc() const noexcept
+template<typename T, typename Crc>
+uint32_t critical_data<T, Crc>::calculate_crc() const noexcept
+{
+    return critical_check<Crc>::calculate((const volatile uint32_t*)&data_, sizeof(data_) / sizeof(uint32_t));
+}
+
+template<typename T, typename Crc>
+constexpr uint32_t critical_data<T, Crc>::calculate_image_crc(const T& data) noexcept
 {
-    return HAL_CRC_Calculate(&hcrc, (uint32_t*)&data_, sizeof(data_) / sizeof(uint32_t));
+    return critical_check<Crc>::calculate_image(std::bit_cast<std::array<uint32_t, sizeof(T) / sizeof(uint32_t)>>(data));
 }
 
-template<typename T>
-volatile T& critical_data<T>::get() noexcept
+template<typename T, typename Crc>
+volatile T& critical_data<T, Crc>::get() noexcept
 {
     return data_;
 }
 
-template<typename T>
-volatile const T& critical_data<T>::get() const noexcept
+template<typename T, typename Crc>
+volatile const T& critical_data<T, Crc>::get() const noexcept
 {
     return data_;
 }
 
-template<typename T>
-void critical_data<T>::set(const T& data) noexcept
+template<typename T, typename Crc>
+void critical_data<T, Crc>::set(const T& data) noexcept
 {
     data_ = data;
     crc_ = calculate_crc();
+    verified_ = critical_epoch::current();
+#ifdef BENCHMARK
+    ++critical_stats::writes;
+#endif
+}
+
+template<typename T, typename Crc>
+bool critical_data<T, Crc>::same_as(const critical_data& other) const noexcept
+{
+    return crc_ == other.crc_ && critical_equal((const volatile uint32_t*)&data_, (const volatile uint32_t*)&other.data_, sizeof(T) / sizeof(uint32_t));
 }
 
-template<typename T>
-bool critical_data<T>::operator!() const noexcept
+template<typename T, typename Crc>
+void critical_data<T, Crc>::clone(const critical_data& other) noexcept
+{
+    critical_copy((volatile uint32_t*)&data_, (const volatile uint32_t*)&other.data_, sizeof(T) / sizeof(uint32_t));
+    crc_ = other.crc_;
+    verified_ = other.verified_;
+}
+
+template<typename T, typename Crc>
+bool critical_data<T, Crc>::operator!() const noexcept
 {
     return !is_valid();
 }
 
-template<typename T>
-critical_data<T>::operator volatile T&() noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>::operator volatile T&() noexcept
 {
     return data_;
 }
 
-template<typename T>
-critical_data<T>::operator volatile const T&() const noexcept
+template<typename T, typename Crc>
+critical_data<T, Crc>::operator volatile const T&() const noexcept
 {
     return data_;
 }
 
-template<typename T>
-uint32_t critical_data<T>::update_crc(uint32_t new_crc) const noexcept
+template<typename T, typename Crc>
+uint32_t critical_data<T, Crc>::update_crc(uint32_t new_crc) const noexcept
 {
     crc_ = new_crc;
     return crc_;
 }
 
-template<typename T>
-bool critical_data<T>::is_valid() const noexcept
+template<typename T, typename Crc>
+bool critical_data<T, Crc>::is_valid() const noexcept
 {
-    return crc_ == calculate_crc();
+    return critical_check<Crc>::is_valid((const volatile uint32_t*)&data_, sizeof(data_) / sizeof(uint32_t), crc_, verified_);
 }
 
-#define CRITICAL(T, N) __attribute__((section(".critical"))) critical_data<T> N
+template<typename T, typename Crc>
+bool critical_data<T, Crc>::verify() const noexcept
+{
+    return critical_check<Crc>::verify((const volatile uint32_t*)&data_, sizeof(data_) / sizeof(uint32_t), crc_, verified_);
+}
+
+// Placement of the primary copy and of every replica, by protection level.
+// BACKUP_PLACEMENT_SRAM keeps the primary copy in the main SRAM, BACKUP_PLACEMENT_CCMRAM
+// moves it to the zero wait state CCMRAM that no DMA master can reach. The replicas
+// are split over SRAM1 (.backup1) and SRAM2 (.backup2, .backup3) either way.
+#define BACKUP_PLACEMENT_SRAM 0
+#define BACKUP_PLACEMENT_CCMRAM 1
+
+#ifndef BACKUP_PLACEMENT
+#define BACKUP_PLACEMENT BACKUP_PLACEMENT_SRAM
+#endif
+
+#if BACKUP_PLACEMENT == BACKUP_PLACEMENT_CCMRAM
+#define BACKUP_SECTION_PRIMARY ".ccm_critical"
+#elif BACKUP_PLACEMENT == BACKUP_PLACEMENT_SRAM
+#define BACKUP_SECTION_PRIMARY ".critical"
+#else
+#error "Unknown BACKUP_PLACEMENT"
+#endif
+#define BACKUP_SECTION_BACKUP1 ".backup1"
+#define BACKUP_SECTION_BACKUP2 ".backup2"
+#define BACKUP_SECTION_BACKUP3 ".backup3"
+
+#define CRITICAL(T, N, ...) __attribute__((section(BACKUP_SECTION_PRIMARY))) constinit critical_data<T> N{critical_image, T{__VA_ARGS__}}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#ifndef __CRITICAL_JOURNAL_HPP
+#define __CRITICAL_JOURNAL_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include "critical_data.hpp"
+
+// Shadow and commit journal over a protected group P, usually a critical_record.
+// An update writes the whole group into the shadow slot, with one crc, then flips
+// the commit word with a single store. A reset at any point leaves either the old
+// or the new group committed, never a mix of both, and finding it takes one read.
+// Has the interface of P so the BACKUP macros work on it.
+template<typename P>
+class critical_journal final
+{
+public:
+    template<size_t I>
+    using field_type = typename P::template field_type<I>;
+
+    // Skip crc calculate for static initializations
+    explicit critical_journal() noexcept {}
+    template<typename... Args>
+    constexpr critical_journal(critical_image_t, const Args&... args) noexcept;
+    ~critical_journal() noexcept {};
+
+    template<size_t I>
+    field_type<I> get() const noexcept;
+    // Both copy the committed group into the shadow slot first when only part of it changes.
+    // A committed group that fails its check is not committed again, the write returns false.
+    template<size_t I>
+    bool set(const field_type<I>& value) noexcept;
+    template<typename... Vs>
+    void set(const Vs&... values) noexcept;
+    bool is_valid() const noexcept;
+    bool verify() const noexcept;
+
+    // Compare or copy both slots and the commit word as they are, a copy only writes the
+    // slots that differ, after an update that is the new committed slot and the commit word
+    bool same_as(const critical_journal& other) const noexcept;
+    void clone(const critical_journal& other) noexcept;
+
+    bool operator!() const noexcept;
+
+private:
+    // Sequence number in the upper half, its complement in the lower half,
+    // the committed slot is the lowest bit of the sequence
+    static constexpr uint32_t make_commit(uint32_t sequence) noexcept
+    {
+        return (sequence << 16) | (~sequence & 0xFFFF);
+    }
+
+    bool commit_valid() const noexcept;
+    const P& committed() const noexcept;
+    P& shadow() noexcept;
+    void commit() noexcept;
+
+    P slot0_;
+    P slot1_;
+    volatile uint32_t commit_;
+};
+
+template<typename P>
+template<typename... Args>
+constexpr critical_journal<P>::critical_journal(critical_image_t, const Args&... args) noexcept
+    : slot0_(critical_image, args...), slot1_(critical_image, args...), commit_(make_commit(0))
+{
+}
+
+template<typename P>
+bool critical_journal<P>::commit_valid() const noexcept
+{
+    const uint32_t commit = commit_;
+    return (commit >> 16) == (~commit & 0xFFFF);
+}
+
+template<typename P>
+const P& critical_journal<P>::committed() const noexcept
+{
+    return ((commit_ >> 16) & 1) ? slot1_ : slot0_;
+}
+
+template<typename P>
+P& critical_journal<P>::shadow() noexcept
+{
+    return ((commit_ >> 16) & 1) ? slot0_ : slot1_;
+}
+
+template<typename P>
+void critical_journal<P>::commit() noexcept
+{
+    commit_ = make_commit((commit_ >> 16) + 1);
+}
+
+template<typename P>
+template<size_t I>
+auto critical_journal<P>::get() const noexcept -> field_type<I>
+{
+    return committed().template get<I>();
+}
+
+template<typename P>
+template<size_t I>
+bool critical_journal<P>::set(const field_type<I>& value) noexcept
+{
+    P& next = shadow();
+    next.clone(committed());
+    if (!next.template set<I>(value))
+        return false;
+    commit();
+    return true;
+}
+
+template<typename P>
+template<typename... Vs>
+void critical_journal<P>::set(const Vs&... values) noexcept
+{
+    shadow().set(values...);
+    commit();
+}
+
+template<typename P>
+bool critical_journal<P>::is_valid() const noexcept
+{
+    return commit_valid() && committed().is_valid();
+}
+
+template<typename P>
+bool critical_journal<P>::verify() const noexcept
+{
+    return commit_valid() && committed().verify();
+}
+
+template<typename P>
+bool critical_journal<P>::same_as(const critical_journal& other) const noexcept
+{
+    return commit_ == other.commit_ && slot0_.same_as(other.slot0_) && slot1_.same_as(other.slot1_);
+}
+
+template<typename P>
+void critical_journal<P>::clone(const critical_journal& other) noexcept
+{
+    // Slots first, a reset before the commit word leaves the copy on its old group
+    if (!slot0_.same_as(other.slot0_))
+        slot0_.clone(other.slot0_);
+    if (!slot1_.same_as(other.slot1_))
+        slot1_.clone(other.slot1_);
+    commit_ = other.commit_;
+}
+
+template<typename P>
+bool critical_journal<P>::operator!() const noexcept
+{
+    return !is_valid();
+}
+
+#endif
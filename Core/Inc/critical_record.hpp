@@ -0,0 +1,201 @@
+#ifndef __CRITICAL_RECORD_HPP
+#define __CRITICAL_RECORD_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <tuple>
+#include <utility>
+
+#include "critical_data.hpp"
+
+// Several related fields protected by a single crc, fields are addressed by index
+// and every update, of one field or of all of them, costs one crc calculation.
+template<typename Crc, typename... Ts>
+class basic_critical_record final
+{
+public:
+    // Ensure that every field is a multiple of 4 bytes
+    static_assert(((sizeof(Ts) % sizeof(uint32_t) == 0) && ...));
+
+    template<size_t I>
+    using field_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+    static constexpr size_t word_count = (sizeof(Ts) + ...) / sizeof(uint32_t);
+    static_assert(critical_check<Crc>::template fits<word_count>);
+
+    // Skip crc calculate for static initializations
+    explicit basic_critical_record() noexcept {}
+    constexpr basic_critical_record(critical_image_t, const Ts&... values) noexcept;
+    ~basic_critical_record() noexcept {};
+    basic_critical_record& operator=(const basic_critical_record& other) noexcept;
+
+    template<size_t I>
+    field_type<I> get() const noexcept;
+    // False when the record fails its check and the write is dropped
+    template<size_t I>
+    bool set(const field_type<I>& value) noexcept;
+    void set(const Ts&... values) noexcept;
+    bool is_valid() const noexcept;
+    bool verify() const noexcept;
+
+    // Compare or copy fields and crc as they are, for replicas of an already checked copy
+    bool same_as(const basic_critical_record& other) const noexcept;
+    void clone(const basic_critical_record& other) noexcept;
+
+    uint32_t calculate_crc() const noexcept;
+
+    bool operator!() const noexcept;
+
+private:
+    using words_t = std::array<uint32_t, word_count>;
+
+    template<size_t I>
+    static constexpr size_t offset() noexcept;
+    static constexpr words_t pack(const Ts&... values) noexcept;
+
+    template<size_t... Is>
+    constexpr basic_critical_record(const words_t& words, std::index_sequence<Is...>) noexcept;
+
+    volatile uint32_t words_[word_count];
+    volatile uint32_t crc_;
+    mutable volatile uint32_t verified_;
+};
+
+template<typename... Ts>
+using critical_record = basic_critical_record<critical_check_default, Ts...>;
+
+template<typename Crc, typename... Ts>
+template<size_t I>
+constexpr size_t basic_critical_record<Crc, Ts...>::offset() noexcept
+{
+    constexpr size_t sizes[] = { sizeof(Ts)... };
+    size_t result = 0;
+    for (size_t i = 0; i < I; ++i)
+        result += sizes[i] / sizeof(uint32_t);
+    return result;
+}
+
+template<typename Crc, typename... Ts>
+constexpr auto basic_critical_record<Crc, Ts...>::pack(const Ts&... values) noexcept -> words_t
+{
+    words_t words{};
+    size_t offset = 0;
+    auto append = [&](const auto& value)
+    {
+        const auto field = std::bit_cast<std::array<uint32_t, sizeof(value) / sizeof(uint32_t)>>(value);
+        for (size_t i = 0; i < field.size(); ++i)
+            words[offset++] = field[i];
+    };
+    (append(values), ...);
+    return words;
+}
+
+template<typename Crc, typename... Ts>
+template<size_t... Is>
+constexpr basic_critical_record<Crc, Ts...>::basic_critical_record(const words_t& words, std::index_sequence<Is...>) noexcept
+    : words_{ words[Is]... }, crc_(critical_check<Crc>::calculate_image(words)), verified_(0)
+{
+}
+
+template<typename Crc, typename... Ts>
+constexpr basic_critical_record<Crc, Ts...>::basic_critical_record(critical_image_t, const Ts&... values) noexcept
+    : basic_critical_record(pack(values...), std::make_index_sequence<word_count>{})
+{
+}
+
+template<typename Crc, typename... Ts>
+basic_critical_record<Crc, Ts...>& basic_critical_record<Crc, Ts...>::operator=(const basic_critical_record& other) noexcept
+{
+    for (size_t i = 0; i < word_count; ++i)
+        words_[i] = other.words_[i];
+    crc_ = calculate_crc();
+    verified_ = critical_epoch::current();
+#ifdef BENCHMARK
+    ++critical_stats::writes;
+#endif
+    return *this;
+}
+
+template<typename Crc, typename... Ts>
+template<size_t I>
+auto basic_critical_record<Crc, Ts...>::get() const noexcept -> field_type<I>
+{
+    std::array<uint32_t, sizeof(field_type<I>) / sizeof(uint32_t)> field;
+    for (size_t i = 0; i < field.size(); ++i)
+        field[i] = words_[offset<I>() + i];
+    return std::bit_cast<field_type<I>>(field);
+}
+
+template<typename Crc, typename... Ts>
+template<size_t I>
+bool basic_critical_record<Crc, Ts...>::set(const field_type<I>& value) noexcept
+{
+    // The other fields are kept and sealed under the new crc, so they have to pass a full check
+    // first. A write into a record that fails it is dropped, it stays invalid for the replicas.
+    if (!verify())
+        return false;
+    const auto field = std::bit_cast<std::array<uint32_t, sizeof(field_type<I>) / sizeof(uint32_t)>>(value);
+    for (size_t i = 0; i < field.size(); ++i)
+        words_[offset<I>() + i] = field[i];
+    crc_ = calculate_crc();
+    verified_ = critical_epoch::current();
+#ifdef BENCHMARK
+    ++critical_stats::writes;
+#endif
+    return true;
+}
+
+template<typename Crc, typename... Ts>
+void basic_critical_record<Crc, Ts...>::set(const Ts&... values) noexcept
+{
+    const words_t words = pack(values...);
+    for (size_t i = 0; i < word_count; ++i)
+        words_[i] = words[i];
+    crc_ = calculate_crc();
+    verified_ = critical_epoch::current();
+#ifdef BENCHMARK
+    ++critical_stats::writes;
+#endif
+}
+
+template<typename Crc, typename... Ts>
+bool basic_critical_record<Crc, Ts...>::same_as(const basic_critical_record& other) const noexcept
+{
+    return crc_ == other.crc_ && critical_equal(words_, other.words_, word_count);
+}
+
+template<typename Crc, typename... Ts>
+void basic_critical_record<Crc, Ts...>::clone(const basic_critical_record& other) noexcept
+{
+    critical_copy(words_, other.words_, word_count);
+    crc_ = other.crc_;
+    verified_ = other.verified_;
+}
+
+template<typename Crc, typename... Ts>
+uint32_t basic_critical_record<Crc, Ts...>::calculate_crc() const noexcept
+{
+    return critical_check<Crc>::calculate(words_, word_count);
+}
+
+template<typename Crc, typename... Ts>
+bool basic_critical_record<Crc, Ts...>::is_valid() const noexcept
+{
+    return critical_check<Crc>::is_valid(words_, word_count, crc_, verified_);
+}
+
+template<typename Crc, typename... Ts>
+bool basic_critical_record<Crc, Ts...>::verify() const noexcept
+{
+    return critical_check<Crc>::verify(words_, word_count, crc_, verified_);
+}
+
+template<typename Crc, typename... Ts>
+bool basic_critical_record<Crc, Ts...>::operator!() const noexcept
+{
+    return !is_valid();
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __CYCLE_PROFILE_HPP
+#define __CYCLE_PROFILE_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <bit>
+#include <limits>
+#include <stddef.h>
+#include <stdint.h>
+
+// Cycle counts of N code paths, each with its extremes, total and a log2 histogram.
+// Bucket k counts the runs of 2^k up to 2^(k+1)-1 cycles, bucket 0 takes 0 and 1 too.
+template<size_t N>
+class cycle_profile final
+{
+public:
+    static constexpr uint32_t buckets = 32;
+
+    struct path
+    {
+        uint32_t count;
+        uint32_t min_cycles;
+        uint32_t max_cycles;
+        uint64_t total_cycles;
+        uint32_t histogram[buckets];
+
+        uint32_t mean_cycles() const noexcept { return count == 0 ? 0 : static_cast<uint32_t>(total_cycles / count); }
+    };
+
+    // Skip initialization for static objects, a section the startup code does not fill is
+    // checked with valid() and cleared once
+    explicit cycle_profile() noexcept {}
+    ~cycle_profile() noexcept {}
+
+    bool valid() const noexcept { return magic_ == kMagic; }
+    void clear() noexcept
+    {
+        for (path& p : paths_)
+            p = { 0, std::numeric_limits<uint32_t>::max(), 0, 0, {} };
+        magic_ = kMagic;
+    }
+
+    void record(size_t index, uint32_t cycles) noexcept
+    {
+        path& p = paths_[index];
+        ++p.count;
+        p.total_cycles += cycles;
+        if (cycles < p.min_cycles)
+            p.min_cycles = cycles;
+        if (cycles > p.max_cycles)
+            p.max_cycles = cycles;
+        ++p.histogram[bucket(cycles)];
+    }
+
+    static constexpr uint32_t bucket(uint32_t cycles) noexcept
+    {
+        return cycles == 0 ? 0 : 31 - std::countl_zero(cycles);
+    }
+
+    const path& operator[](size_t index) const noexcept { return paths_[index]; }
+    static constexpr size_t size() noexcept { return N; }
+
+private:
+    static constexpr uint32_t kMagic = 0xC7C1E500u;
+
+    uint32_t magic_;
+    path paths_[N];
+};
+
+#endif
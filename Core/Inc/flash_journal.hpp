@@ -0,0 +1,246 @@
+#ifndef __FLASH_JOURNAL_HPP
+#define __FLASH_JOURNAL_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include "crc32.hpp"
+
+// Two erase sectors of NOR flash the journal lives in. Programming can only clear
+// bits, only an erase sets a whole sector back to 0xFFFFFFFF.
+struct journal_flash
+{
+    volatile uint32_t* sectors[2];
+    uint32_t sector_words;
+    bool (*erase)(volatile uint32_t* sector, uint32_t words) noexcept;
+    bool (*program)(volatile uint32_t* address, uint32_t word) noexcept;
+};
+
+#if !defined(CRITICAL_DATA_HOST) && defined(PERSIST_FLASH)
+// Sectors 10 and 11, the last 256KB of the device, reserved by the linker script only when
+// this build places the journal there
+journal_flash journal_flash_internal() noexcept;
+#endif
+
+// NOR flash simulated over RAM with the same bit rules, for the host and the benchmarks
+struct journal_flash_ram final
+{
+    static bool erase(volatile uint32_t* sector, uint32_t words) noexcept
+    {
+        for (uint32_t i = 0; i < words; ++i)
+            sector[i] = 0xFFFFFFFF;
+        return true;
+    }
+
+    static bool program(volatile uint32_t* address, uint32_t word) noexcept
+    {
+        *address = *address & word;
+        return *address == word;
+    }
+
+    static journal_flash make(uint32_t* sector0, uint32_t* sector1, uint32_t sector_words) noexcept
+    {
+        return { { sector0, sector1 }, sector_words, erase, program };
+    }
+};
+
+// Log structured key/value journal over two flash sectors. Every record is a key, a value
+// and a crc appended after the previous one, the newest valid record of a key wins. Only
+// when the active sector fills up are the live values copied into the other sector, so a
+// sector is erased once per fill. Mounting finds the write position by binary search and
+// loads the keys in one backwards pass over at most one sector.
+template<size_t Keys>
+class flash_journal final
+{
+public:
+    static_assert(Keys > 0 && Keys <= 32);
+
+    struct statistics
+    {
+        uint32_t erases;
+        uint32_t appends;
+        uint32_t compactions;
+        uint32_t mount_records; // records read by the last mount, its bound is one sector
+    };
+
+    constexpr explicit flash_journal(const journal_flash& flash) noexcept : flash_(flash) {}
+
+    // Formats the first sector if neither holds a journal
+    bool mount() noexcept;
+    bool mounted() const noexcept { return active_ >= 0; }
+    bool get(uint32_t key, uint32_t& value) const noexcept;
+    // Appends unless the key already holds the value, compacts first if the sector is full
+    bool set(uint32_t key, uint32_t value) noexcept;
+
+    // Records left in the active sector before the next compaction
+    uint32_t free_slots() const noexcept { return mounted() ? slot_count() - end_ : 0; }
+    const statistics& stats() const noexcept { return stats_; }
+
+private:
+    // Slot 0 of a sector is its header, the rest are records
+    static constexpr uint32_t slot_words = 3;
+    static constexpr uint32_t magic = 0x4A524E4C;
+    static constexpr uint32_t erased = 0xFFFFFFFF;
+
+    // Key in the upper half and its complement in the lower half, never erased
+    static constexpr uint32_t make_tag(uint32_t key) noexcept
+    {
+        return (key << 16) | (~key & 0xFFFF);
+    }
+
+    uint32_t slot_count() const noexcept { return flash_.sector_words / slot_words; }
+    volatile uint32_t* slot(int sector, uint32_t index) const noexcept
+    {
+        return flash_.sectors[sector] + index * slot_words;
+    }
+    static bool slot_valid(const volatile uint32_t* words) noexcept
+    {
+        return crc32_default::calculate(words, 2) == words[2];
+    }
+    bool slot_erased(const volatile uint32_t* words) const noexcept
+    {
+        return words[0] == erased && words[1] == erased && words[2] == erased;
+    }
+
+    bool header_valid(int sector) const noexcept;
+    bool write_slot(volatile uint32_t* words, uint32_t first, uint32_t second) noexcept;
+    bool format(int sector, uint32_t generation) noexcept;
+    bool compact() noexcept;
+    uint32_t find_end(int sector) const noexcept;
+
+    journal_flash flash_;
+    int active_ = -1;
+    uint32_t end_ = 0; // first free slot of the active sector
+    uint32_t values_[Keys] = {};
+    uint32_t present_ = 0;
+    statistics stats_ = {};
+};
+
+template<size_t Keys>
+bool flash_journal<Keys>::header_valid(int sector) const noexcept
+{
+    const volatile uint32_t* header = slot(sector, 0);
+    return header[0] == magic && slot_valid(header);
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::write_slot(volatile uint32_t* words, uint32_t first, uint32_t second) noexcept
+{
+    const uint32_t data[] = { first, second };
+    // The crc goes last, a slot cut short never turns valid
+    return flash_.program(words, first)
+        && flash_.program(words + 1, second)
+        && flash_.program(words + 2, crc32_default::calculate(data, 2));
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::format(int sector, uint32_t generation) noexcept
+{
+    ++stats_.erases;
+    if (!flash_.erase(flash_.sectors[sector], flash_.sector_words))
+        return false;
+    // Copy the live values before the header, a compaction cut short leaves the old sector active
+    uint32_t end = 1;
+    for (uint32_t key = 0; key < Keys; ++key)
+        if (present_ & (1u << key))
+            if (!write_slot(slot(sector, end++), make_tag(key), values_[key]))
+                return false;
+    if (!write_slot(slot(sector, 0), magic, generation))
+        return false;
+    active_ = sector;
+    end_ = end;
+    return true;
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::compact() noexcept
+{
+    ++stats_.compactions;
+    return format(1 - active_, slot(active_, 0)[1] + 1);
+}
+
+template<size_t Keys>
+uint32_t flash_journal<Keys>::find_end(int sector) const noexcept
+{
+    // Slots are filled in order, so the used ones form a prefix
+    uint32_t low = 1;
+    uint32_t high = slot_count();
+    while (low < high)
+    {
+        const uint32_t middle = low + (high - low) / 2;
+        if (slot(sector, middle)[0] == erased)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return low;
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::mount() noexcept
+{
+    active_ = -1;
+    present_ = 0;
+    stats_.mount_records = 0;
+    if (slot_count() < Keys + 2)
+        return false;
+
+    const bool valid0 = header_valid(0);
+    const bool valid1 = header_valid(1);
+    if (!valid0 && !valid1)
+        return format(0, 1);
+    if (valid0 && valid1)
+        active_ = static_cast<int32_t>(slot(1, 0)[1] - slot(0, 0)[1]) > 0 ? 1 : 0;
+    else
+        active_ = valid0 ? 0 : 1;
+    end_ = find_end(active_);
+
+    const uint32_t all = Keys == 32 ? 0xFFFFFFFF : (1u << Keys) - 1;
+    for (uint32_t i = end_; i > 1 && present_ != all; --i)
+    {
+        const volatile uint32_t* words = slot(active_, i - 1);
+        ++stats_.mount_records;
+        const uint32_t key = words[0] >> 16;
+        if (words[0] != make_tag(key) || key >= Keys || (present_ & (1u << key)) || !slot_valid(words))
+            continue;
+        values_[key] = words[1];
+        present_ |= 1u << key;
+    }
+    return true;
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::get(uint32_t key, uint32_t& value) const noexcept
+{
+    if (key >= Keys || !(present_ & (1u << key)))
+        return false;
+    value = values_[key];
+    return true;
+}
+
+template<size_t Keys>
+bool flash_journal<Keys>::set(uint32_t key, uint32_t value) noexcept
+{
+    if (!mounted() || key >= Keys)
+        return false;
+    if ((present_ & (1u << key)) && values_[key] == value)
+        return true;
+
+    // Slots left dirty by an interrupted write are skipped
+    while (end_ < slot_count() && !slot_erased(slot(active_, end_)))
+        ++end_;
+    if (end_ >= slot_count() && !compact())
+        return false;
+
+    ++stats_.appends;
+    const bool written = write_slot(slot(active_, end_++), make_tag(key), value);
+    if (written)
+    {
+        values_[key] = value;
+        present_ |= 1u << key;
+    }
+    return written;
+}
+
+#endif
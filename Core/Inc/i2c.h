@@ -10,6 +10,15 @@ extern "C" {
 // Actual defined in main.c
 extern I2C_HandleTypeDef hi2c1;
 
+#define I2C_GPIO_PORT GPIOB
+#define I2C_SCL_PIN GPIO_PIN_6
+#define I2C_SDA_PIN GPIO_PIN_7
+
+// Idle bus and both devices answering their address
+uint8_t I2C_IsHealthy(void);
+// Releases a stuck bus and initializes the peripheral again, the devices are left as they are
+HAL_StatusTypeDef I2C_Recover(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,6 +7,8 @@ extern "C" {
 
 #include "stm32f4xx_hal.h"
 
+#define LM75A_SLAVEADDR 0x9F
+
 // 寄存器指针地址
 #define LM75A_ADDR_TEMP		0x00 // 温度寄存器指针地址
 #define LM75A_ADDR_CONF		0x01 // 配置寄存器指针地址
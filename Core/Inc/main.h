@@ -53,6 +53,9 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void App_Loop(void) __attribute__((noreturn));
+void App_Restart(void) __attribute__((noreturn));
+void App_Quiesce(void);
 
 /* USER CODE END EFP */
 
@@ -0,0 +1,141 @@
+#ifndef __PERSIST_HPP
+#define __PERSIST_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <array>
+
+#include "crc32.hpp"
+
+// Words of memory that keep their content without the main supply, the battery backed
+// BKPSRAM on target, any array on the host to exercise the restore path without hardware
+struct persist_region
+{
+    volatile uint32_t* words;
+    size_t count;
+};
+
+#ifndef CRITICAL_DATA_HOST
+// Enables the backup domain and the backup regulator, BKPSRAM keeps its content on VBAT
+// from then on. An empty region if the regulator does not come up.
+persist_region persist_bkpsram() noexcept;
+#endif
+
+// Mirror of a group of N words in a persist_region, kept in two slots each with its own
+// sequence number and crc. A save always goes to the older slot and writes the crc last,
+// so a supply lost half way through leaves the previous save to be restored.
+template<size_t N, typename Crc = crc32_default>
+class persist_mirror final
+{
+public:
+    using words_t = std::array<uint32_t, N>;
+
+    // Tag, sequence, N words and the crc over all of them
+    static constexpr size_t slot_words = N + 3;
+    static constexpr size_t region_words = 2 * slot_words;
+
+    constexpr explicit persist_mirror(const persist_region& region, size_t offset = 0) noexcept
+        : region_{ region.words + offset, region.count > offset ? region.count - offset : 0 }
+    {
+    }
+
+    bool attached() const noexcept;
+    // Newest valid save, false if there is none
+    bool load(words_t& words) const noexcept;
+    // Skipped if the newest save already holds the same words
+    void save(const words_t& words) noexcept;
+    void erase() noexcept;
+
+private:
+    // Changes with the group size, a save of another layout never loads
+    static constexpr uint32_t tag = 0xB5A70000 | N;
+
+    volatile uint32_t* slot(size_t i) const noexcept;
+    bool slot_valid(size_t i) const noexcept;
+    // Index of the newest valid slot, -1 if there is none
+    int newest() const noexcept;
+
+    persist_region region_;
+};
+
+template<size_t N, typename Crc>
+bool persist_mirror<N, Crc>::attached() const noexcept
+{
+    return region_.words != nullptr && region_.count >= region_words;
+}
+
+template<size_t N, typename Crc>
+volatile uint32_t* persist_mirror<N, Crc>::slot(size_t i) const noexcept
+{
+    return region_.words + i * slot_words;
+}
+
+template<size_t N, typename Crc>
+bool persist_mirror<N, Crc>::slot_valid(size_t i) const noexcept
+{
+    const volatile uint32_t* words = slot(i);
+    return words[0] == tag && Crc::calculate(words, N + 2) == words[N + 2];
+}
+
+template<size_t N, typename Crc>
+int persist_mirror<N, Crc>::newest() const noexcept
+{
+    if (!attached())
+        return -1;
+    const bool valid0 = slot_valid(0);
+    const bool valid1 = slot_valid(1);
+    if (valid0 && valid1)
+        return static_cast<int32_t>(slot(1)[1] - slot(0)[1]) > 0 ? 1 : 0;
+    return valid0 ? 0 : valid1 ? 1 : -1;
+}
+
+template<size_t N, typename Crc>
+bool persist_mirror<N, Crc>::load(words_t& words) const noexcept
+{
+    const int i = newest();
+    if (i < 0)
+        return false;
+    const volatile uint32_t* current = slot(i);
+    for (size_t j = 0; j < N; ++j)
+        words[j] = current[j + 2];
+    return true;
+}
+
+template<size_t N, typename Crc>
+void persist_mirror<N, Crc>::save(const words_t& words) noexcept
+{
+    if (!attached())
+        return;
+    const int i = newest();
+    uint32_t sequence = 0;
+    if (i >= 0)
+    {
+        const volatile uint32_t* current = slot(i);
+        bool same = true;
+        for (size_t j = 0; j < N && same; ++j)
+            same = current[j + 2] == words[j];
+        if (same)
+            return;
+        sequence = current[1];
+    }
+
+    volatile uint32_t* next = slot(i == 0 ? 1 : 0);
+    next[0] = tag;
+    next[1] = sequence + 1;
+    for (size_t j = 0; j < N; ++j)
+        next[j + 2] = words[j];
+    next[N + 2] = Crc::calculate(next, N + 2);
+}
+
+template<size_t N, typename Crc>
+void persist_mirror<N, Crc>::erase() noexcept
+{
+    if (!attached())
+        return;
+    for (size_t j = 0; j < region_words; ++j)
+        region_.words[j] = 0;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __SCRUB_HPP
+#define __SCRUB_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <stdint.h>
+
+#include "telemetry.hpp"
+
+// Records scrubbed per idle slot, a full sweep takes ceil(entries / SCRUB_RECORDS_PER_SLOT) slots
+#ifndef SCRUB_RECORDS_PER_SLOT
+#define SCRUB_RECORDS_PER_SLOT 2
+#endif
+
+// Minimum time between two slots in ms, 0 scrubs in every idle slot
+#ifndef SCRUB_SLOT_PERIOD_MS
+#define SCRUB_SLOT_PERIOD_MS 0
+#endif
+
+// Without a slot period the sweeps follow the idle slots and nothing bounds how far apart they are
+constexpr uint32_t SCRUB_LATENCY_UNBOUNDED = UINT32_MAX;
+
+enum scrub_result_t
+{
+    SCRUB_CLEAN,
+    SCRUB_REPAIRED,
+    SCRUB_LOST,
+};
+
+// Descriptor of one protected variable and its replicas, emitted into the .scrub
+// flash table by the BACKUP and VOTED macros and walked between _sscrub and _escrub
+struct scrub_entry
+{
+    const char* name;
+    scrub_result_t (*scrub)() noexcept;
+    telemetry_counters* telemetry;
+};
+
+// Expects the x##_telemetry counters of the variable to be declared
+#define SCRUB_REGISTER(x, ...) \
+__attribute__((section(".scrub"), used)) constinit const scrub_entry x##_scrub{ #x, +[]() noexcept -> scrub_result_t { return __VA_ARGS__; }, &x##_telemetry }
+
+struct SCRUB_Statistics
+{
+    uint32_t entries;
+    uint32_t records_per_slot;
+    uint32_t slot_period_ms;
+    uint32_t latency_bound_ms; // worst case detection latency from the configuration, SCRUB_LATENCY_UNBOUNDED without a slot period
+    uint32_t sweeps;
+    uint32_t last_sweep_ms; // measured duration of the last full sweep, the observed detection latency
+    uint32_t max_sweep_ms;
+    uint32_t repairs;
+    uint32_t lost;
+};
+extern SCRUB_Statistics SCRUB_Stats;
+
+// Scrub the next SCRUB_RECORDS_PER_SLOT records, called from idle slots
+void SCRUB_Step();
+// Scrub every record at once
+void SCRUB_All();
+
+#endif
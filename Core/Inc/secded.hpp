@@ -0,0 +1,115 @@
+#ifndef __SECDED_HPP
+#define __SECDED_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hamming position of every data bit, the positions 3..38 that are not powers of two
+constexpr uint8_t ecc_secded_position(size_t bit) noexcept
+{
+    uint8_t pos = 2;
+    for (size_t i = 0; i <= bit; ++i)
+        do ++pos; while ((pos & (pos - 1)) == 0);
+    return pos;
+}
+
+struct ecc_secded_tables
+{
+    uint32_t masks[6]; // data bits covered by every check bit
+    int8_t bits[64]; // data bit of every syndrome, -1 if none
+};
+
+constexpr ecc_secded_tables ecc_secded_make_tables() noexcept
+{
+    ecc_secded_tables tables{};
+    for (auto& bit : tables.bits)
+        bit = -1;
+    for (size_t i = 0; i < 32; ++i)
+    {
+        const uint8_t pos = ecc_secded_position(i);
+        tables.bits[pos] = static_cast<int8_t>(i);
+        for (size_t j = 0; j < 6; ++j)
+            if (pos & (1 << j))
+                tables.masks[j] |= 1u << i;
+    }
+    return tables;
+}
+
+// Hamming(39,32) SECDED policy for critical_data, an alternative to the crc policies.
+// Each data word gets 6 Hamming check bits and an overall parity bit, packed into one
+// byte of the check word, so a protected value holds at most 4 words. A single bit flip
+// in a word, data or check bits, is corrected in place, two flips are detected.
+struct ecc_secded final
+{
+    using image = ecc_secded;
+
+    static constexpr size_t max_words = 4;
+
+    enum result_t
+    {
+        ECC_CLEAN,
+        ECC_CORRECTED,
+        ECC_UNCORRECTABLE,
+    };
+
+    static constexpr ecc_secded_tables tables = ecc_secded_make_tables();
+
+    static constexpr uint32_t parity(uint32_t value) noexcept
+    {
+        return __builtin_parity(value);
+    }
+
+    // Check byte of a word, Hamming bits in 0..5 and the overall parity in bit 6
+    static constexpr uint32_t encode(uint32_t word) noexcept
+    {
+        uint32_t check = 0;
+        for (size_t j = 0; j < 6; ++j)
+            check |= parity(word & tables.masks[j]) << j;
+        return check | (parity(word) ^ parity(check)) << 6;
+    }
+
+    template<typename Word>
+    static constexpr uint32_t calculate(const Word* words, size_t count) noexcept
+    {
+        uint32_t check = 0;
+        for (size_t i = 0; i < count; ++i)
+            check |= encode(words[i]) << (i * 8);
+        return check;
+    }
+
+    static result_t correct(volatile uint32_t* words, size_t count, volatile uint32_t& check) noexcept
+    {
+        result_t result = ECC_CLEAN;
+        uint32_t new_check = check;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const uint32_t word = words[i];
+            const uint32_t stored = (new_check >> (i * 8)) & 0x7F;
+            const uint32_t syndrome = (encode(word) ^ stored) & 0x3F;
+            const bool parity_error = parity(word) ^ parity(stored);
+            if (syndrome == 0 && !parity_error)
+                continue;
+            if (!parity_error)
+                return ECC_UNCORRECTABLE;
+            // Odd number of flips, either a data bit or one of the check bits
+            const int8_t bit = tables.bits[syndrome];
+            if (bit >= 0)
+                words[i] = word ^ (1u << bit);
+            else if (syndrome != 0 && (syndrome & (syndrome - 1)) != 0)
+                return ECC_UNCORRECTABLE;
+            new_check = (new_check & ~(0xFFu << (i * 8))) | (encode(words[i]) << (i * 8));
+            result = ECC_CORRECTED;
+        }
+        if (result == ECC_CORRECTED)
+            check = new_check;
+        return result;
+    }
+};
+
+static_assert(ecc_secded_position(0) == 3 && ecc_secded_position(31) == 38);
+
+#endif
@@ -9,6 +9,8 @@ extern "C" {
 
 void SM_Init();
 void SM_Run();
+// Raises the timed events, called from SysTick
+void SM_Tick();
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,200 @@
+#ifndef __TASKS_HPP
+#define __TASKS_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <coroutine>
+
+#include "critical_record.hpp"
+
+#include "stm32f4xx_hal.h"
+
+// Slots of the scheduler, every task is spawned once at start and runs forever
+#ifndef TASKS_MAX
+#define TASKS_MAX 6
+#endif
+
+// Bytes for all coroutine frames together, a frame never comes from the heap
+#ifndef TASKS_ARENA_SIZE
+#define TASKS_ARENA_SIZE 2048
+#endif
+
+// Longest a single interrupt driven I2C transfer may take before the bus is recovered
+#ifndef TASKS_I2C_TIMEOUT_MS
+#define TASKS_I2C_TIMEOUT_MS 20
+#endif
+
+// Completion of the transfer of the task holding the bus, the lower bits belong to the application
+constexpr uint32_t TASKS_EVENT_I2C = 1u << 31;
+
+// Stackless coroutine run by the scheduler. It starts suspended and its frame is carved
+// from a static arena, so a full arena makes the coroutine call return an empty task.
+class task final
+{
+public:
+    struct promise_type
+    {
+        task get_return_object() noexcept { return task{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        static task get_return_object_on_allocation_failure() noexcept { return task{}; }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {}
+
+        static void* operator new(size_t size) noexcept;
+        // Frames live until the next reset, the arena is never given back
+        static void operator delete(void*) noexcept {}
+    };
+
+    task() noexcept = default;
+    std::coroutine_handle<> handle() const noexcept { return handle_; }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+    std::coroutine_handle<> handle_;
+};
+
+enum
+{
+    TASKS_WAIT_DEADLINE, // tick the task wakes at when timed
+    TASKS_WAIT_TIMED, // 0: events only, 1: deadline too
+    TASKS_WAIT_EVENTS, // events any of which wakes the task
+};
+// What a suspended task waits for. A corrupted one wakes the task, a task checks its
+// condition again after every wake, so waking early is safe and sleeping forever is not.
+using task_wait_record = critical_record<uint32_t, uint32_t, uint32_t>;
+
+struct TASKS_Statistics
+{
+    uint32_t tasks;
+    uint32_t arena_used;
+    uint32_t resumes;
+    uint32_t corrupted_waits;
+    uint32_t i2c_timeouts;
+};
+extern TASKS_Statistics TASKS_Stats;
+
+// False if the task is empty or no slot is left
+bool TASKS_Spawn(const task& t) noexcept;
+// Resumes every task whose wait is over once, in spawn order, false if none was
+bool TASKS_Run() noexcept;
+// True if TASKS_Run would resume a task, called with interrupts masked before sleeping
+bool TASKS_Ready() noexcept;
+// Safe from interrupts
+void TASKS_Signal(uint32_t events) noexcept;
+// Clears and returns the pending ones of the events
+uint32_t TASKS_Take(uint32_t events) noexcept;
+
+void TASKS_Suspend(uint32_t deadline, bool timed, uint32_t events) noexcept;
+// Events the running task was woken by, 0 on the deadline or a corrupted wait
+uint32_t TASKS_Woken() noexcept;
+
+// co_await suspends until one of the events or the deadline, and yields the events
+class task_wait final
+{
+public:
+    constexpr task_wait(uint32_t deadline, bool timed, uint32_t events) noexcept
+        : deadline_(deadline), timed_(timed), events_(events)
+    {
+    }
+
+    bool await_ready() noexcept
+    {
+        woken_ = TASKS_Take(events_);
+        return woken_ != 0 || (timed_ && static_cast<int32_t>(HAL_GetTick() - deadline_) >= 0);
+    }
+    void await_suspend(std::coroutine_handle<>) const noexcept { TASKS_Suspend(deadline_, timed_, events_); }
+    uint32_t await_resume() const noexcept { return woken_ != 0 ? woken_ : TASKS_Woken(); }
+
+private:
+    uint32_t deadline_;
+    bool timed_;
+    uint32_t events_;
+    uint32_t woken_ = 0;
+};
+
+inline task_wait TASKS_Delay(uint32_t ms) noexcept
+{
+    return { HAL_GetTick() + ms, true, 0 };
+}
+
+inline task_wait TASKS_Wait(uint32_t events) noexcept
+{
+    return { 0, false, events };
+}
+
+inline task_wait TASKS_Wait(uint32_t events, uint32_t timeout_ms) noexcept
+{
+    return { HAL_GetTick() + timeout_ms, true, events };
+}
+
+// Ownership of a shared bus between tasks. A waiting task is given the lock by the
+// scheduler before it resumes, so co_await lock() always returns with the lock held.
+class task_lock final
+{
+public:
+    class awaiter final
+    {
+    public:
+        explicit awaiter(task_lock& lock) noexcept : lock_(lock) {}
+        bool await_ready() const noexcept { return lock_.try_lock(); }
+        void await_suspend(std::coroutine_handle<>) const noexcept;
+        void await_resume() const noexcept {}
+
+    private:
+        task_lock& lock_;
+    };
+
+    awaiter lock() noexcept { return awaiter{ *this }; }
+    bool try_lock() noexcept
+    {
+        if (locked_)
+            return false;
+        locked_ = true;
+        return true;
+    }
+    void unlock() noexcept { locked_ = false; }
+    bool locked() const noexcept { return locked_; }
+
+private:
+    bool locked_ = false;
+};
+
+// Memory transfer on I2C1 driven by its interrupts, co_await suspends until it completes
+// and yields its status. A transfer that times out recovers the bus before returning.
+// Only for the task holding the bus lock, the buffer has to outlive the co_await.
+class task_i2c final
+{
+public:
+    static task_i2c read(uint16_t device, uint16_t reg, uint8_t* data, uint16_t size) noexcept
+    {
+        return { device, reg, data, size, false };
+    }
+    static task_i2c write(uint16_t device, uint16_t reg, uint8_t* data, uint16_t size) noexcept
+    {
+        return { device, reg, data, size, true };
+    }
+
+    bool await_ready() noexcept;
+    void await_suspend(std::coroutine_handle<>) const noexcept;
+    HAL_StatusTypeDef await_resume() noexcept;
+
+private:
+    task_i2c(uint16_t device, uint16_t reg, uint8_t* data, uint16_t size, bool write) noexcept
+        : device_(device), reg_(reg), data_(data), size_(size), write_(write)
+    {
+    }
+
+    uint16_t device_;
+    uint16_t reg_;
+    uint8_t* data_;
+    uint16_t size_;
+    bool write_;
+    HAL_StatusTypeDef status_ = HAL_OK;
+    uint32_t deadline_ = 0;
+};
+
+#endif
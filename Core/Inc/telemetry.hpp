@@ -0,0 +1,24 @@
+#ifndef __TELEMETRY_HPP
+#define __TELEMETRY_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <stdint.h>
+
+// Corruption and repair counts of one protected variable. Plain words without a crc,
+// counting is a single increment and only happens on the failure paths. Kept in the
+// .telemetry section across reset jumps, cleared by the bootstrap code on power-on.
+struct telemetry_counters
+{
+    uint32_t primary_invalid; // the primary copy failed its check
+    uint32_t replica_used; // a replica, or the vote of the copies, replaced the primary
+    uint32_t all_invalid; // no copy passed, the variable is left to fall back to its default
+    uint32_t repair_writes; // copies rewritten to bring them back in line
+};
+
+#define TELEMETRY(x) \
+__attribute__((section(".telemetry"))) telemetry_counters x##_telemetry
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f4xx_hal.h"
+
+// Entries of the post-mortem ring, a power of two so the index is a mask
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 256
+#endif
+
+#if (TRACE_ENTRIES & (TRACE_ENTRIES - 1)) != 0
+#error "TRACE_ENTRIES must be a power of two"
+#endif
+
+// State field of the entries not made by a state or a task
+#define TRACE_STATE_NONE 0xFF
+
+// Set in the reason field of an entry made while the core ran on the 16MHz HSI, as it does
+// after a reset until SystemClock_Config switches to the 168MHz PLL. A reset jump keeps the PLL.
+#define TRACE_REASON_HSI 0x80
+
+// Why an entry was written, the host decoder in Tools/trace_decode.py knows them by number
+typedef enum
+{
+    TRACE_REASON_BOOT, // first entry after a reset, the state field holds RCC->CSR >> 24
+    TRACE_REASON_STEP, // a state of the table ran
+    TRACE_REASON_FLOW_ERROR, // the signature register did not name the state
+    TRACE_REASON_BAD_SUCCESSOR, // a state returned one its row does not list, the state field holds it
+    TRACE_REASON_TASK, // a task was resumed, the state field holds its slot
+    TRACE_REASON_REJUVENATION, // soft rejuvenation started over
+    TRACE_REASON_ERROR_HANDLER,
+    TRACE_REASON_HARD_FAULT,
+} TRACE_Reason;
+
+// Two words per entry. The event word packs the state in bits 0-7, the reason and the clock
+// in 8-15 and the low half of the sequence number in 16-31, so the decoder finds the oldest
+// entry and tells entries of this run from the ones left over by an earlier one.
+typedef struct
+{
+    uint32_t event;
+    uint32_t cycles; // DWT CYCCNT, nothing clears it and it runs on across reset jumps
+} TRACE_Entry;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t head; // entries written since the ring was cleared, the next goes to head % TRACE_ENTRIES
+    TRACE_Entry entries[TRACE_ENTRIES];
+} TRACE_Ring;
+
+// In .noinit, kept across reset jumps, Error_Handler and watchdog resets
+extern TRACE_Ring TRACE_Log;
+
+// Checks the ring left by the last run and clears it if it is not one, then enables the
+// cycle counter and records the boot. Called once by Boostrap before anything is traced.
+void TRACE_Init(uint32_t reset_flags);
+
+// The entry and the head, three stores and no branch
+static inline void TRACE_RecordTo(TRACE_Ring* ring, uint32_t state, uint32_t reason)
+{
+    const uint32_t sequence = ring->head;
+    TRACE_Entry* entry = &ring->entries[sequence & (TRACE_ENTRIES - 1)];
+    const uint32_t clock = (RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_HSI ? TRACE_REASON_HSI : 0;
+    entry->event = (state & 0xFF) | (reason | clock) << 8 | sequence << 16;
+    entry->cycles = DWT->CYCCNT;
+    ring->head = sequence + 1;
+}
+
+static inline void TRACE_Record(uint32_t state, uint32_t reason)
+{
+    TRACE_RecordTo(&TRACE_Log, state, reason);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
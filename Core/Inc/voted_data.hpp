@@ -0,0 +1,167 @@
+#ifndef __VOTED_DATA_HPP
+#define __VOTED_DATA_HPP
+
+#ifndef __cplusplus
+#error "This header is only for C++"
+#endif
+
+#include <utility>
+
+#include "critical_data.hpp"
+#include "scrub.hpp"
+
+// One of three plain copies of a value, read through a bitwise 2-of-3 majority vote.
+// Reading needs no crc and no branch per word, the copies are only compared to decide
+// whether the voted value has to be written back to them.
+template<typename T>
+class voted_data final
+{
+public:
+    // Ensure that the size of the data type is a multiple of 4 bytes
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0);
+
+    static constexpr size_t word_count = sizeof(T) / sizeof(uint32_t);
+
+    // Skip initialization for static objects
+    explicit voted_data() noexcept {}
+    constexpr voted_data(critical_image_t, const T& data) noexcept;
+    ~voted_data() noexcept {};
+
+    // Vote a value out of the three copies, false if some word has no two agreeing
+    // copies, in which case the copies are left untouched
+    static bool read(voted_data& a, voted_data& b, voted_data& c, T& data, telemetry_counters& telemetry) noexcept;
+    static void write(voted_data& a, voted_data& b, voted_data& c, const T& data) noexcept;
+    static bool is_valid(const voted_data& a, const voted_data& b, const voted_data& c) noexcept;
+    static scrub_result_t scrub(voted_data& a, voted_data& b, voted_data& c, telemetry_counters& telemetry) noexcept;
+
+private:
+    using words_t = std::array<uint32_t, word_count>;
+
+    template<size_t... Is>
+    constexpr voted_data(const words_t& words, std::index_sequence<Is...>) noexcept;
+
+    // Vote every word and repair the copies, see read
+    static bool vote(voted_data& a, voted_data& b, voted_data& c, words_t& words, bool& diverged, telemetry_counters& telemetry) noexcept;
+
+    volatile uint32_t words_[word_count];
+};
+
+template<typename T>
+template<size_t... Is>
+constexpr voted_data<T>::voted_data(const words_t& words, std::index_sequence<Is...>) noexcept
+    : words_{ words[Is]... }
+{
+}
+
+template<typename T>
+constexpr voted_data<T>::voted_data(critical_image_t, const T& data) noexcept
+    : voted_data(std::bit_cast<words_t>(data), std::make_index_sequence<word_count>{})
+{
+}
+
+template<typename T>
+bool voted_data<T>::read(voted_data& a, voted_data& b, voted_data& c, T& data, telemetry_counters& telemetry) noexcept
+{
+    words_t words;
+    bool diverged;
+    const bool valid = vote(a, b, c, words, diverged, telemetry);
+    if (!valid)
+        ++telemetry.all_invalid;
+    data = std::bit_cast<T>(words);
+    return valid;
+}
+
+template<typename T>
+scrub_result_t voted_data<T>::scrub(voted_data& a, voted_data& b, voted_data& c, telemetry_counters& telemetry) noexcept
+{
+    words_t words;
+    bool diverged;
+    if (!vote(a, b, c, words, diverged, telemetry))
+        return SCRUB_LOST;
+    return diverged ? SCRUB_REPAIRED : SCRUB_CLEAN;
+}
+
+template<typename T>
+bool voted_data<T>::vote(voted_data& a, voted_data& b, voted_data& c, words_t& words, bool& diverged, telemetry_counters& telemetry) noexcept
+{
+    // Copies outvoted in some word, bit 0 for a, 1 for b and 2 for c
+    uint32_t outvoted = 0;
+    // Set when some word was voted out of bits of different copies, matching fewer than two
+    uint32_t unmatched = 0;
+    for (size_t i = 0; i < word_count; ++i)
+    {
+        const uint32_t x = a.words_[i];
+        const uint32_t y = b.words_[i];
+        const uint32_t z = c.words_[i];
+        const uint32_t vote = (x & y) | (x & z) | (y & z);
+        words[i] = vote;
+        const uint32_t off_x = vote != x;
+        const uint32_t off_y = vote != y;
+        const uint32_t off_z = vote != z;
+        outvoted |= off_x | off_y << 1 | off_z << 2;
+        unmatched |= off_x + off_y + off_z > 1;
+    }
+    diverged = outvoted != 0;
+    if (!diverged)
+        return true;
+
+    if (outvoted & 1)
+        ++telemetry.primary_invalid;
+    if (unmatched)
+        return false;
+    if (outvoted & 1)
+        ++telemetry.replica_used;
+    telemetry.repair_writes += __builtin_popcount(outvoted);
+    for (size_t i = 0; i < word_count; ++i)
+    {
+        a.words_[i] = words[i];
+        b.words_[i] = words[i];
+        c.words_[i] = words[i];
+    }
+    return true;
+}
+
+template<typename T>
+void voted_data<T>::write(voted_data& a, voted_data& b, voted_data& c, const T& data) noexcept
+{
+    const auto words = std::bit_cast<words_t>(data);
+    for (size_t i = 0; i < word_count; ++i)
+    {
+        a.words_[i] = words[i];
+        b.words_[i] = words[i];
+        c.words_[i] = words[i];
+    }
+}
+
+template<typename T>
+bool voted_data<T>::is_valid(const voted_data& a, const voted_data& b, const voted_data& c) noexcept
+{
+    for (size_t i = 0; i < word_count; ++i)
+    {
+        const uint32_t x = a.words_[i];
+        const uint32_t y = b.words_[i];
+        const uint32_t z = c.words_[i];
+        if (x != y && x != z && y != z)
+            return false;
+    }
+    return true;
+}
+
+// The copies go to the primary and first two backup sections, so they are spread like BACKUP ones
+#define VOTED(T, x, ...) \
+__attribute__((section(BACKUP_SECTION_PRIMARY))) constinit voted_data<T> x{critical_image, T{__VA_ARGS__}}; \
+__attribute__((section(BACKUP_SECTION_BACKUP1))) constinit voted_data<T> x##_backup1{critical_image, T{__VA_ARGS__}}; \
+__attribute__((section(BACKUP_SECTION_BACKUP2))) constinit voted_data<T> x##_backup2{critical_image, T{__VA_ARGS__}}; \
+TELEMETRY(x); \
+SCRUB_REGISTER(x, voted_data<T>::scrub(x, x##_backup1, x##_backup2, x##_telemetry))
+
+#define VOTED_GET(x, y) \
+decltype(x)::read(x, x##_backup1, x##_backup2, y, x##_telemetry)
+
+#define VOTED_SET(x, y) \
+decltype(x)::write(x, x##_backup1, x##_backup2, y)
+
+#define VOTED_IS_VALID(x) \
+decltype(x)::is_valid(x, x##_backup1, x##_backup2)
+
+#endif
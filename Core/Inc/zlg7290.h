@@ -78,6 +78,8 @@ enum
 
 #define ZLG7290_TIMEOUT_FLAG    ((uint32_t)0x1000)
 #define ZLG7290_TIMEOUT_LONG    ((uint32_t)0xffff)
+// The controller ignores the bus for this long after every byte written
+#define ZLG7290_WRITE_GAP_MS    5
 
 void ZLG7290_Set_Retries(uint32_t retries);
 void ZLG7290_Set_Timeout(uint32_t timeout);
@@ -1,6 +1,131 @@
 #include "beep.h"
 
+#define BEEP_FOREVER            0xFFFFFFFF
+#define BEEP_PULSE_US           100000
+#define BEEP_ESCALATING_STEPS   4
+
+// PG6 has no timer channel, so TIM6 interrupts at every half period of the tone and the
+// pin is toggled there. Everything is in microseconds, one TIM6 count.
+static volatile BEEP_Pattern BEEP_Current;
+static volatile uint32_t BEEP_Frequency;
+static volatile uint32_t BEEP_HalfPeriod;
+static volatile uint32_t BEEP_Left;
+static volatile uint32_t BEEP_SegmentLeft;
+static volatile uint8_t BEEP_Sounding;
+static volatile uint8_t BEEP_Playing;
+static volatile uint32_t BEEP_Step;
+
 void BEEP_SwitchMode(uint8_t mode)
 {
     HAL_GPIO_WritePin(GPIOG, GPIO_PIN_6, mode);
-}
\ No newline at end of file
+}
+
+static void BEEP_SetFrequency(uint32_t frequency)
+{
+    BEEP_HalfPeriod = 500000 / frequency;
+    // Preloaded, takes effect at the next update
+    __HAL_TIM_SET_AUTORELOAD(&htim6, BEEP_HalfPeriod - 1);
+}
+
+// Tone and pause alternate, only the continuous pattern has a single endless segment
+static void BEEP_NextSegment(void)
+{
+    switch (BEEP_Current)
+    {
+    case BEEP_PATTERN_CONTINUOUS:
+        BEEP_Sounding = 1;
+        BEEP_SegmentLeft = BEEP_FOREVER;
+        break;
+    case BEEP_PATTERN_PULSED:
+        BEEP_Sounding = !BEEP_Sounding;
+        BEEP_SegmentLeft = BEEP_PULSE_US;
+        break;
+    case BEEP_PATTERN_ESCALATING:
+        BEEP_Sounding = !BEEP_Sounding;
+        BEEP_SegmentLeft = BEEP_PULSE_US;
+        if (BEEP_Sounding)
+        {
+            BEEP_Step = (BEEP_Step + 1) % BEEP_ESCALATING_STEPS;
+            BEEP_SetFrequency(BEEP_Frequency + BEEP_Frequency * BEEP_Step / 2);
+        }
+        break;
+    }
+}
+
+static void BEEP_Begin(BEEP_Pattern pattern, uint32_t frequency, uint32_t duration_ms)
+{
+    HAL_TIM_Base_Stop_IT(&htim6);
+    BEEP_SwitchMode(BEEP_MODE_OFF);
+    if (frequency == 0 || frequency > 500000)
+    {
+        BEEP_Playing = 0;
+        return;
+    }
+
+    BEEP_Current = pattern;
+    BEEP_Frequency = frequency;
+    BEEP_Left = duration_ms == 0 || duration_ms >= BEEP_FOREVER / 1000 ? BEEP_FOREVER : duration_ms * 1000;
+    BEEP_Sounding = 0;
+    // The first tone of the escalating pattern is the lowest step
+    BEEP_Step = BEEP_ESCALATING_STEPS - 1;
+    BEEP_SetFrequency(frequency);
+    BEEP_NextSegment();
+
+    // Load the new period now instead of after the old one, and clear the flag UG sets
+    __HAL_TIM_SET_COUNTER(&htim6, 0);
+    htim6.Instance->EGR = TIM_EGR_UG;
+    __HAL_TIM_CLEAR_FLAG(&htim6, TIM_FLAG_UPDATE);
+    BEEP_Playing = 1;
+    HAL_TIM_Base_Start_IT(&htim6);
+}
+
+void BEEP_Start(uint32_t frequency)
+{
+    BEEP_Begin(BEEP_PATTERN_CONTINUOUS, frequency, 0);
+}
+
+void BEEP_Play(BEEP_Pattern pattern, uint32_t duration_ms)
+{
+    BEEP_Begin(pattern, BEEP_TONE_HZ, duration_ms);
+}
+
+void BEEP_Stop(void)
+{
+    HAL_TIM_Base_Stop_IT(&htim6);
+    BEEP_SwitchMode(BEEP_MODE_OFF);
+    BEEP_Playing = 0;
+}
+
+uint8_t BEEP_IsPlaying(void)
+{
+    return BEEP_Playing;
+}
+
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef* htim)
+{
+    if (htim->Instance != TIM6)
+        return;
+
+    const uint32_t elapsed = BEEP_HalfPeriod;
+    if (BEEP_Left != BEEP_FOREVER)
+    {
+        if (BEEP_Left <= elapsed)
+        {
+            BEEP_Stop();
+            return;
+        }
+        BEEP_Left -= elapsed;
+    }
+    if (BEEP_SegmentLeft != BEEP_FOREVER)
+    {
+        if (BEEP_SegmentLeft <= elapsed)
+            BEEP_NextSegment();
+        else
+            BEEP_SegmentLeft -= elapsed;
+    }
+
+    if (BEEP_Sounding)
+        HAL_GPIO_TogglePin(GPIOG, GPIO_PIN_6);
+    else
+        BEEP_SwitchMode(BEEP_MODE_OFF);
+}
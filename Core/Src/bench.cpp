@@ -0,0 +1,356 @@
+#include "bench.h"
+
+#ifdef BENCHMARK
+
+#include "backup_data.hpp"
+#include "cfcss.hpp"
+#include "dwt.h"
+#include "flash_journal.hpp"
+#include "persist.hpp"
+#include "trace.h"
+#include "voted_data.hpp"
+
+BENCH_BootResult BENCH_Boot;
+
+template<typename Crc>
+static uint32_t BENCH_CrcCycles(const volatile uint32_t* words, size_t count)
+{
+    const uint32_t start = DWT_GetCycles();
+    volatile uint32_t crc = Crc::calculate(words, count);
+    (void)crc;
+    return DWT_GetCycles() - start;
+}
+
+// Total cycles to checksum kBenchCrcWords words with each CRC backend
+struct BENCH_Crc32Result
+{
+    uint32_t words;
+    uint32_t hw;
+    uint32_t sw4;
+    uint32_t sw8;
+};
+BENCH_Crc32Result BENCH_Crc32;
+
+static void BENCH_RunCrc32()
+{
+    constexpr size_t kBenchCrcWords = 256;
+    static uint32_t buffer[kBenchCrcWords];
+    for (size_t i = 0; i < kBenchCrcWords; ++i)
+        buffer[i] = i * 0x9E3779B9;
+
+    BENCH_Crc32.words = kBenchCrcWords;
+    BENCH_Crc32.hw = BENCH_CrcCycles<crc32_hw>(buffer, kBenchCrcWords);
+    BENCH_Crc32.sw4 = BENCH_CrcCycles<crc32_sw<4>>(buffer, kBenchCrcWords);
+    BENCH_Crc32.sw8 = BENCH_CrcCycles<crc32_sw<8>>(buffer, kBenchCrcWords);
+}
+
+// Edit context and thresholds of the state machine, one critical_data per field against
+// one critical_record per group, each with a primary copy and three replicas
+struct BENCH_RecordResult
+{
+    uint32_t separate_bytes;
+    uint32_t separate_cycles;
+    uint32_t record_bytes;
+    uint32_t record_cycles;
+};
+BENCH_RecordResult BENCH_Record;
+
+static void BENCH_RunRecord()
+{
+    constexpr size_t kCopies = 4;
+    constexpr size_t kFields = 6;
+    static critical_data<uint32_t> separate[kCopies][kFields];
+    static critical_record<uint32_t, uint32_t, uint32_t, uint32_t> edit_context[kCopies];
+    static critical_record<uint32_t, uint32_t> thresholds[kCopies];
+
+    uint32_t start = DWT_GetCycles();
+    for (size_t copy = 0; copy < kCopies; ++copy)
+        for (size_t field = 0; field < kFields; ++field)
+            separate[copy][field].set(field);
+    BENCH_Record.separate_cycles = DWT_GetCycles() - start;
+    BENCH_Record.separate_bytes = sizeof(separate);
+
+    start = DWT_GetCycles();
+    for (size_t copy = 0; copy < kCopies; ++copy)
+    {
+        edit_context[copy].set(0u, 1u, 2u, 3u);
+        thresholds[copy].set(4u, 5u);
+    }
+    BENCH_Record.record_cycles = DWT_GetCycles() - start;
+    BENCH_Record.record_bytes = sizeof(edit_context) + sizeof(thresholds);
+}
+
+// Random single bit flips in the primary copy, data or check word, each followed by
+// a validation and a BACKUP_SYNC. ECC corrects in place where CRC restores a replica.
+struct BENCH_FaultResult
+{
+    uint32_t bytes;
+    uint32_t injections;
+    uint32_t cycles;
+    uint32_t replica_restores;
+    uint32_t lost;
+};
+BENCH_FaultResult BENCH_FaultCrc;
+BENCH_FaultResult BENCH_FaultEcc;
+
+template<typename Check>
+static void BENCH_RunFaultInjection(BENCH_FaultResult& result)
+{
+    constexpr uint32_t kInjections = 256;
+    constexpr uint32_t kValue = 0x5A5AA5A5;
+    static critical_data<uint32_t, Check> value, value_backup1, value_backup2, value_backup3;
+    static telemetry_counters value_telemetry;
+    BACKUP_SET(value, kValue);
+
+    result = {};
+    result.bytes = 4 * sizeof(value);
+    result.injections = kInjections;
+    for (uint32_t i = 0; i < kInjections; ++i)
+    {
+        // Leave the trust window so the flip is actually looked for
+        for (uint32_t epoch = 0; epoch < CRITICAL_TRUST_EPOCHS; ++epoch)
+            critical_epoch::advance();
+        const uint32_t bit = RNG->DR % 64;
+        volatile uint32_t* words = (volatile uint32_t*)&value;
+        words[bit / 32] = words[bit / 32] ^ (1u << (bit % 32));
+
+        const uint32_t start = DWT_GetCycles();
+        const bool primary_valid = value.is_valid();
+        BACKUP_SYNC(value);
+        result.cycles += DWT_GetCycles() - start;
+
+        if (!primary_valid)
+            ++result.replica_restores;
+        if (value.get() != kValue)
+            ++result.lost;
+    }
+}
+
+// Average BACKUP_GET cost with the primary copy in SRAM1 and in CCMRAM, the replicas
+// are in their usual sections. Cached reads hit the trust window, uncached ones run the crc.
+struct BENCH_PlacementResult
+{
+    uint32_t sram_cached;
+    uint32_t sram_uncached;
+    uint32_t ccmram_cached;
+    uint32_t ccmram_uncached;
+};
+BENCH_PlacementResult BENCH_Placement;
+
+#define BENCH_PLACED(S, x) \
+__attribute__((section(S))) static constinit critical_data<uint32_t> x{critical_image, 1u}; \
+__attribute__((section(BACKUP_SECTION_BACKUP1))) static constinit critical_data<uint32_t> x##_backup1{critical_image, 1u}; \
+__attribute__((section(BACKUP_SECTION_BACKUP2))) static constinit critical_data<uint32_t> x##_backup2{critical_image, 1u}; \
+__attribute__((section(BACKUP_SECTION_BACKUP3))) static constinit critical_data<uint32_t> x##_backup3{critical_image, 1u}; \
+static telemetry_counters x##_telemetry
+
+template<typename P>
+static void BENCH_RunBackupGet(P& value, P& value_backup1, P& value_backup2, P& value_backup3, telemetry_counters& value_telemetry, uint32_t& cached, uint32_t& uncached)
+{
+    constexpr uint32_t kRounds = 64;
+    uint32_t result;
+    BACKUP_SET(value, 1u);
+
+    uint32_t start = DWT_GetCycles();
+    for (uint32_t i = 0; i < kRounds; ++i)
+    {
+        BACKUP_GET(value, result);
+    }
+    cached = (DWT_GetCycles() - start) / kRounds;
+
+    uint32_t cycles = 0;
+    for (uint32_t i = 0; i < kRounds; ++i)
+    {
+        for (uint32_t epoch = 0; epoch < CRITICAL_TRUST_EPOCHS; ++epoch)
+            critical_epoch::advance();
+        start = DWT_GetCycles();
+        BACKUP_GET(value, result);
+        cycles += DWT_GetCycles() - start;
+    }
+    uncached = cycles / kRounds;
+    (void)result;
+}
+
+static void BENCH_RunPlacement()
+{
+    BENCH_PLACED(".critical", sram);
+    BENCH_PLACED(".ccm_critical", ccmram);
+    BENCH_RunBackupGet(sram, sram_backup1, sram_backup2, sram_backup3, sram_telemetry, BENCH_Placement.sram_cached, BENCH_Placement.sram_uncached);
+    BENCH_RunBackupGet(ccmram, ccmram_backup1, ccmram_backup2, ccmram_backup3, ccmram_telemetry, BENCH_Placement.ccmram_cached, BENCH_Placement.ccmram_uncached);
+}
+
+// Guard and bookkeeping of one state transition, two states taking turns. The voted
+// LastStep with a predecessor bit test against the CFCSS signature check and xor update.
+struct BENCH_ControlFlowResult
+{
+    uint32_t voted_cycles;
+    uint32_t signature_cycles;
+    uint32_t mismatches; // 0 unless a guard rejected a legal transition
+};
+BENCH_ControlFlowResult BENCH_ControlFlow;
+
+static void BENCH_RunControlFlow()
+{
+    constexpr uint32_t kRounds = 64;
+    constexpr uint32_t kPredecessors[2] = { 1u << 1, 1u << 0 };
+    __attribute__((section(BACKUP_SECTION_PRIMARY))) static constinit voted_data<uint32_t> last_step{critical_image, 1u};
+    __attribute__((section(BACKUP_SECTION_BACKUP1))) static constinit voted_data<uint32_t> last_step_backup1{critical_image, 1u};
+    __attribute__((section(BACKUP_SECTION_BACKUP2))) static constinit voted_data<uint32_t> last_step_backup2{critical_image, 1u};
+    static telemetry_counters last_step_telemetry;
+    static constexpr std::array<uint32_t, 2> kSignatures = cfcss_signatures<2>();
+    __attribute__((section(BACKUP_SECTION_PRIMARY))) static constinit cfcss_register signature{critical_image, kSignatures[0]};
+
+    uint32_t mismatches = 0;
+    uint32_t start = DWT_GetCycles();
+    for (uint32_t i = 0; i < kRounds; ++i)
+    {
+        const uint32_t operation = i & 1;
+        uint32_t previous;
+        if (!VOTED_GET(last_step, previous) || previous >= 2 || !(kPredecessors[operation] & (1u << previous)))
+            ++mismatches;
+        VOTED_SET(last_step, operation);
+    }
+    BENCH_ControlFlow.voted_cycles = (DWT_GetCycles() - start) / kRounds;
+
+    start = DWT_GetCycles();
+    for (uint32_t i = 0; i < kRounds; ++i)
+    {
+        const uint32_t operation = i & 1;
+        if (!signature.check(kSignatures[operation]))
+            ++mismatches;
+        signature.update(kSignatures[operation] ^ kSignatures[operation ^ 1]);
+    }
+    BENCH_ControlFlow.signature_cycles = (DWT_GetCycles() - start) / kRounds;
+    BENCH_ControlFlow.mismatches = mismatches;
+}
+
+// One post-mortem trace record, into a ring of its own so the one kept across resets
+// does not lose its history to the benchmark
+struct BENCH_TraceResult
+{
+    uint32_t record_cycles;
+};
+BENCH_TraceResult BENCH_Trace;
+
+static void BENCH_RunTrace()
+{
+    constexpr uint32_t kRounds = 64;
+    static TRACE_Ring ring;
+
+    const uint32_t start = DWT_GetCycles();
+    for (uint32_t i = 0; i < kRounds; ++i)
+        TRACE_RecordTo(&ring, i & 0xF, TRACE_REASON_STEP);
+    BENCH_Trace.record_cycles = (DWT_GetCycles() - start) / kRounds;
+}
+
+// Save and restore of the three word edit state through a persist_mirror, over a plain
+// SRAM array standing in for BKPSRAM so the saved thresholds are left alone
+struct BENCH_PersistResult
+{
+    uint32_t region_bytes;
+    uint32_t save_cycles;
+    uint32_t restore_cycles;
+    uint32_t torn_restored; // 1 if a save cut short before its crc still restores the previous one
+};
+BENCH_PersistResult BENCH_Persist;
+
+static void BENCH_RunPersist()
+{
+    using mirror_t = persist_mirror<3>;
+    static uint32_t mock[mirror_t::region_words];
+    mirror_t mirror{ persist_region{ mock, mirror_t::region_words } };
+    mirror.erase();
+    mirror.save({ 0u, 1u, 2u });
+
+    uint32_t start = DWT_GetCycles();
+    mirror.save({ 0u, 3u, 4u });
+    BENCH_Persist.save_cycles = DWT_GetCycles() - start;
+
+    mirror_t::words_t words;
+    start = DWT_GetCycles();
+    const bool loaded = mirror.load(words);
+    BENCH_Persist.restore_cycles = DWT_GetCycles() - start;
+    BENCH_Persist.region_bytes = sizeof(mock);
+
+    // The older slot, next in line for a save, gets a new sequence and words but no crc
+    mock[1] += 2;
+    mock[3] = 5;
+    BENCH_Persist.torn_restored = loaded && mirror.load(words) && words[1] == 3u && words[2] == 4u;
+}
+
+// Flash journal over the simulated NOR model, so the real sectors are not worn. Appends
+// go round robin over the keys until the sectors have been filled several times.
+struct BENCH_JournalResult
+{
+    uint32_t sector_bytes;
+    uint32_t appends;
+    uint32_t append_cycles; // average, compactions included
+    uint32_t compactions;
+    uint32_t erases;
+    uint32_t mount_cycles; // the active sector full up to its last slot
+    uint32_t mount_records;
+    uint32_t restored; // 1 if the mount found the newest value of every key
+};
+BENCH_JournalResult BENCH_Journal;
+
+static void BENCH_RunJournal()
+{
+    constexpr uint32_t kKeys = 4;
+    constexpr uint32_t kSectorWords = 256;
+    constexpr uint32_t kAppends = 1000;
+    static uint32_t sectors[2][kSectorWords];
+    const journal_flash flash = journal_flash_ram::make(sectors[0], sectors[1], kSectorWords);
+    journal_flash_ram::erase(sectors[0], kSectorWords);
+    journal_flash_ram::erase(sectors[1], kSectorWords);
+
+    flash_journal<kKeys> journal{ flash };
+    journal.mount();
+    uint32_t start = DWT_GetCycles();
+    for (uint32_t i = 0; i < kAppends; ++i)
+        journal.set(i % kKeys, i);
+    BENCH_Journal.append_cycles = (DWT_GetCycles() - start) / kAppends;
+    BENCH_Journal.appends = journal.stats().appends;
+    BENCH_Journal.compactions = journal.stats().compactions;
+    BENCH_Journal.erases = journal.stats().erases;
+    BENCH_Journal.sector_bytes = sizeof(sectors[0]);
+
+    // Fill the active sector up, the worst case of a mount
+    for (uint32_t i = kAppends; journal.free_slots() > 0; ++i)
+        journal.set(0, i);
+
+    flash_journal<kKeys> mounted{ flash };
+    start = DWT_GetCycles();
+    mounted.mount();
+    BENCH_Journal.mount_cycles = DWT_GetCycles() - start;
+    BENCH_Journal.mount_records = mounted.stats().mount_records;
+
+    uint32_t matches = 0;
+    for (uint32_t key = 0; key < kKeys; ++key)
+    {
+        uint32_t expected, value;
+        if (journal.get(key, expected) && mounted.get(key, value) && value == expected)
+            ++matches;
+    }
+    BENCH_Journal.restored = matches == kKeys;
+}
+
+void BENCH_Run()
+{
+    BENCH_RunCrc32();
+    BENCH_RunPersist();
+    BENCH_RunJournal();
+    BENCH_RunPlacement();
+    BENCH_RunRecord();
+    BENCH_RunControlFlow();
+    BENCH_RunTrace();
+    BENCH_RunFaultInjection<crc32_hw>(BENCH_FaultCrc);
+    BENCH_RunFaultInjection<ecc_secded>(BENCH_FaultEcc);
+}
+
+#else
+
+void BENCH_Run()
+{
+}
+
+#endif
@@ -1,39 +1,143 @@
 // The following code would only be executed once,
 // when the program starts.
 
+// Protected sections are constant initialized images with valid crcs,
+// restore them by copying their load images back from the flash.
+static void Bootstrap_CopySection(void** start, void** end, void** image)
+{
+    for (void** p = start; p < end; p++)
+        *p = *image++;
+}
+
 extern void* _scritical;
 extern void* _ecritical;
+extern void* _sicritical;
+extern void* _sccm_critical;
+extern void* _eccm_critical;
+extern void* _siccm_critical;
 void Bootstrap_InitCriticalData()
 {
-    // Set all of the critical section data to 0
-    for (void** p = &_scritical; p < &_ecritical; p++)
-        *p = 0;
+    Bootstrap_CopySection(&_scritical, &_ecritical, &_sicritical);
+    Bootstrap_CopySection(&_sccm_critical, &_eccm_critical, &_siccm_critical);
 }
 
 extern void* _sbackup1;
 extern void* _ebackup1;
+extern void* _sibackup1;
 extern void* _sbackup2;
 extern void* _ebackup2;
+extern void* _sibackup2;
 extern void* _sbackup3;
 extern void* _ebackup3;
+extern void* _sibackup3;
 
 void Boostrap_InitBackupData()
 {
-    // Set all of the backup data to 0
-    for (void** p = &_sbackup1; p < &_ebackup1; p++)
-        *p = 0;
-    for (void** p = &_sbackup2; p < &_ebackup2; p++)
-        *p = 0;
-    for (void** p = &_sbackup3; p < &_ebackup3; p++)
+    Bootstrap_CopySection(&_sbackup1, &_ebackup1, &_sibackup1);
+    Bootstrap_CopySection(&_sbackup2, &_ebackup2, &_sibackup2);
+    Bootstrap_CopySection(&_sbackup3, &_ebackup3, &_sibackup3);
+}
+
+extern void* _stelemetry;
+extern void* _etelemetry;
+
+// Counters start from zero on power-on only, reset jumps keep counting
+static void Bootstrap_ClearTelemetry()
+{
+    for (void** p = &_stelemetry; p < &_etelemetry; p++)
         *p = 0;
 }
 
 #include "stm32f4xx.h"
+#include "crc_dma.h"
+#include "trace.h"
+
+// Signature of every protected section, taken right before a reset jump and
+// checked once after it, so a changed section is known before any variable is read
+#define BOOTSTRAP_SEAL_MAGIC 0x5EA1ED00u
 
-#define IF_MASK(t) if (RCC->CSR & (t))
+typedef struct
+{
+    uint32_t magic;
+    uint32_t signature;
+} Bootstrap_Seal;
+
+__attribute__((section(".noinit"))) static Bootstrap_Seal Bootstrap_SectionSeal;
+
+static const CRC_DMA_Range Bootstrap_Sections[] =
+{
+    { &_scritical, &_ecritical },
+    { &_sbackup1, &_ebackup1 },
+    { &_sbackup2, &_ebackup2 },
+    { &_sbackup3, &_ebackup3 },
+};
+
+extern CRC_HandleTypeDef hcrc;
+
+static HAL_StatusTypeDef Bootstrap_SignSections(uint32_t* signature)
+{
+    if (CRC_DMA_Start(Bootstrap_Sections, sizeof(Bootstrap_Sections) / sizeof(Bootstrap_Sections[0])) != HAL_OK)
+        return HAL_ERROR;
+    if (CRC_DMA_Wait(signature) != HAL_OK)
+        return HAL_ERROR;
+    // No DMA master reaches CCMRAM, the CPU carries on from where the DMA stopped
+    const uint32_t ccm_words = (uint32_t*)&_eccm_critical - (uint32_t*)&_sccm_critical;
+    if (ccm_words > 0)
+        *signature = HAL_CRC_Accumulate(&hcrc, (uint32_t*)&_sccm_critical, ccm_words);
+    return HAL_OK;
+}
+
+void Bootstrap_SealSections()
+{
+    uint32_t signature;
+    if (Bootstrap_SignSections(&signature) != HAL_OK)
+        return;
+    Bootstrap_SectionSeal.signature = signature;
+    Bootstrap_SectionSeal.magic = BOOTSTRAP_SEAL_MAGIC;
+}
+
+uint8_t Bootstrap_CheckSeal()
+{
+    if (Bootstrap_SectionSeal.magic != BOOTSTRAP_SEAL_MAGIC)
+        return 0;
+    // A seal is good for a single reset
+    Bootstrap_SectionSeal.magic = 0;
+    uint32_t signature;
+    return Bootstrap_SignSections(&signature) == HAL_OK && signature == Bootstrap_SectionSeal.signature;
+}
+
+// Flags of the reset that led here, RCC->CSR is cleared right after reading so the flags
+// of a real reset are not seen again after a reset jump
+static uint32_t Bootstrap_ResetFlags;
+static uint8_t Bootstrap_WarmBoot;
+// The protected sections were restored from their flash images by this boot
+static uint8_t Bootstrap_Restored;
+
+#define IF_MASK(t) if (Bootstrap_ResetFlags & (t))
+
+// Only a pin, brown-out or power-on reset reaches the devices on the board
+#define BOOTSTRAP_EXTERNAL_RESETS (RCC_CSR_PORRSTF_Msk | RCC_CSR_BORRSTF_Msk | RCC_CSR_PINRSTF_Msk | RCC_CSR_LPWRRSTF_Msk)
+
+uint8_t Bootstrap_IsWarmBoot()
+{
+    return Bootstrap_WarmBoot;
+}
+
+uint8_t Bootstrap_IsRestored()
+{
+    return Bootstrap_Restored;
+}
 
 void Boostrap()
 {
+    Bootstrap_ResetFlags = RCC->CSR;
+    RCC->CSR |= RCC_CSR_RMVF;
+    // The sections were sealed before the jump and the devices kept running, the seal itself
+    // is checked by SM_Init once the crc unit is up
+    Bootstrap_WarmBoot = (Bootstrap_ResetFlags & BOOTSTRAP_EXTERNAL_RESETS) == 0
+        && Bootstrap_SectionSeal.magic == BOOTSTRAP_SEAL_MAGIC;
+    TRACE_Init(Bootstrap_ResetFlags);
+
     IF_MASK(RCC_CSR_LPWRRSTF_Msk) // Low power reset
     {
 
@@ -54,6 +158,8 @@ void Boostrap()
     {
         Boostrap_InitBackupData();
         Bootstrap_InitCriticalData();
+        Bootstrap_ClearTelemetry();
+        Bootstrap_Restored = 1;
     }
     else IF_MASK(RCC_CSR_PINRSTF_Msk) // Pin reset
     {
@@ -63,7 +169,7 @@ void Boostrap()
     {
 
     }
-    else // Unknown reset, maybe done by the user
+    else // No flag, a reset jump that did not reset anything
     {
         
     }
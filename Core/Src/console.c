@@ -0,0 +1,60 @@
+#include "console.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "usart.h"
+
+typedef struct
+{
+    char key;
+    const char* help;
+    void (*run)(void);
+} CONSOLE_Command;
+
+static const CONSOLE_Command CONSOLE_Commands[] =
+{
+    { 't', "telemetry counters of every protected variable", TELEMETRY_Dump },
+    { 'r', "state transition trace kept across resets", TRACE_Dump },
+#ifdef BENCHMARK
+    { 'p', "cycles per state, min, mean, max and log2 histogram", SM_ProfileDump },
+#endif
+};
+
+#define CONSOLE_COMMAND_COUNT (sizeof(CONSOLE_Commands) / sizeof(CONSOLE_Commands[0]))
+
+static void CONSOLE_Help(void)
+{
+    for (uint32_t i = 0; i < CONSOLE_COMMAND_COUNT; i++)
+        CONSOLE_Printf("%c: %s\r\n", CONSOLE_Commands[i].key, CONSOLE_Commands[i].help);
+}
+
+void CONSOLE_Poll(void)
+{
+    // Reading the data register also clears an overrun, older characters are dropped
+    if (!__HAL_UART_GET_FLAG(&huart1, UART_FLAG_RXNE))
+        return;
+    const char key = (char)(huart1.Instance->DR & 0xFF);
+
+    for (uint32_t i = 0; i < CONSOLE_COMMAND_COUNT; i++)
+        if (CONSOLE_Commands[i].key == key)
+        {
+            CONSOLE_Commands[i].run();
+            return;
+        }
+    CONSOLE_Help();
+}
+
+void CONSOLE_Printf(const char* format, ...)
+{
+    char line[CONSOLE_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length <= 0)
+        return;
+    if (length >= (int)sizeof(line))
+        length = sizeof(line) - 1;
+    HAL_UART_Transmit(&huart1, (uint8_t*)line, (uint16_t)length, 100);
+}
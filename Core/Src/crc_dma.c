@@ -0,0 +1,86 @@
+#include "crc_dma.h"
+
+extern CRC_HandleTypeDef hcrc;
+extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+
+// A single DMA transfer moves at most 65535 items
+#define CRC_DMA_MAX_WORDS 0xFFFFu
+
+static const CRC_DMA_Range* CRC_DMA_Ranges;
+static uint32_t CRC_DMA_Count;
+static const volatile uint32_t* CRC_DMA_Next;
+static volatile uint8_t CRC_DMA_Busy;
+static volatile HAL_StatusTypeDef CRC_DMA_Status;
+
+// Start the next chunk of the current range, or move on to the next range
+static void CRC_DMA_Feed(void)
+{
+    while (CRC_DMA_Count > 0 && CRC_DMA_Next >= (const volatile uint32_t*)CRC_DMA_Ranges->end)
+    {
+        ++CRC_DMA_Ranges;
+        if (--CRC_DMA_Count > 0)
+            CRC_DMA_Next = (const volatile uint32_t*)CRC_DMA_Ranges->start;
+    }
+    if (CRC_DMA_Count == 0)
+    {
+        CRC_DMA_Status = HAL_OK;
+        CRC_DMA_Busy = 0;
+        return;
+    }
+
+    uint32_t words = (const volatile uint32_t*)CRC_DMA_Ranges->end - CRC_DMA_Next;
+    if (words > CRC_DMA_MAX_WORDS)
+        words = CRC_DMA_MAX_WORDS;
+    const uint32_t source = (uint32_t)CRC_DMA_Next;
+    CRC_DMA_Next += words;
+    if (HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream0, source, (uint32_t)&hcrc.Instance->DR, words) != HAL_OK)
+    {
+        CRC_DMA_Status = HAL_ERROR;
+        CRC_DMA_Busy = 0;
+    }
+}
+
+static void CRC_DMA_XferCplt(DMA_HandleTypeDef* hdma)
+{
+    (void)hdma;
+    CRC_DMA_Feed();
+}
+
+static void CRC_DMA_XferError(DMA_HandleTypeDef* hdma)
+{
+    (void)hdma;
+    CRC_DMA_Status = HAL_ERROR;
+    CRC_DMA_Busy = 0;
+}
+
+HAL_StatusTypeDef CRC_DMA_Start(const CRC_DMA_Range* ranges, uint32_t count)
+{
+    if (CRC_DMA_Busy)
+        return HAL_BUSY;
+
+    hdma_memtomem_dma2_stream0.XferCpltCallback = CRC_DMA_XferCplt;
+    hdma_memtomem_dma2_stream0.XferErrorCallback = CRC_DMA_XferError;
+    __HAL_CRC_DR_RESET(&hcrc);
+
+    CRC_DMA_Ranges = ranges;
+    CRC_DMA_Count = count;
+    CRC_DMA_Next = count > 0 ? (const volatile uint32_t*)ranges->start : NULL;
+    CRC_DMA_Status = HAL_BUSY;
+    CRC_DMA_Busy = 1;
+    CRC_DMA_Feed();
+    return CRC_DMA_Status == HAL_ERROR ? HAL_ERROR : HAL_OK;
+}
+
+uint8_t CRC_DMA_IsBusy(void)
+{
+    return CRC_DMA_Busy;
+}
+
+HAL_StatusTypeDef CRC_DMA_Wait(uint32_t* crc)
+{
+    // The transfer complete interrupt wakes the core, SysTick bounds a missed wakeup
+    while (CRC_DMA_Busy)
+        __WFI();
+    *crc = hcrc.Instance->DR;
+    return CRC_DMA_Status;
+}
@@ -0,0 +1,4 @@
+#include "critical_data.hpp"
+
+__attribute__((section(".critical"))) volatile uint32_t critical_epoch::value_ = critical_epoch::mark(1);
+__attribute__((section(".critical"))) volatile uint32_t critical_epoch::complement_ = ~critical_epoch::mark(1);
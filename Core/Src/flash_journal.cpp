@@ -0,0 +1,65 @@
+#include "flash_journal.hpp"
+
+#include "stm32f4xx_hal.h"
+
+#ifdef PERSIST_FLASH
+constexpr uint32_t kJournalSectorWords = 128 * 1024 / sizeof(uint32_t);
+
+// Placed at sector 10 by the linker script, which keeps the rest of the image out of it
+__attribute__((section(".journal"))) static volatile uint32_t JOURNAL_Sectors[2 * kJournalSectorWords];
+
+// A 128KB sector takes up to 2s to erase, longer than the watchdog window. Every fetch from
+// the bank stalls from the start bit on, so the whole erase runs from RAM with interrupts off,
+// touches nothing but registers and keeps the watchdog fed by writing its key register.
+__attribute__((section(".RamFunc"), noinline)) static void JOURNAL_EraseSector(uint32_t number)
+{
+    FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB)) | FLASH_PSIZE_WORD | FLASH_CR_SER | number << FLASH_CR_SNB_Pos;
+    FLASH->CR = FLASH->CR | FLASH_CR_STRT;
+    while (FLASH->SR & FLASH_SR_BSY)
+        IWDG->KR = 0xAAAA;
+    FLASH->CR = FLASH->CR & ~(FLASH_CR_SER | FLASH_CR_SNB);
+}
+
+static bool JOURNAL_Erase(volatile uint32_t* sector, uint32_t words) noexcept
+{
+    (void)words;
+    const uint32_t number = sector == JOURNAL_Sectors ? FLASH_SECTOR_10 : FLASH_SECTOR_11;
+    if (HAL_FLASH_Unlock() != HAL_OK)
+        return false;
+    if (FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK)
+    {
+        HAL_FLASH_Lock();
+        return false;
+    }
+
+    __disable_irq();
+    JOURNAL_EraseSector(number);
+    // The data cache may still hold the words from before the erase
+    if (FLASH->ACR & FLASH_ACR_DCEN)
+    {
+        __HAL_FLASH_DATA_CACHE_DISABLE();
+        __HAL_FLASH_DATA_CACHE_RESET();
+        __HAL_FLASH_DATA_CACHE_ENABLE();
+    }
+    __enable_irq();
+
+    const bool erased = (FLASH->SR & (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)) == 0;
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+    HAL_FLASH_Lock();
+    return erased;
+}
+
+static bool JOURNAL_Program(volatile uint32_t* address, uint32_t word) noexcept
+{
+    if (HAL_FLASH_Unlock() != HAL_OK)
+        return false;
+    const HAL_StatusTypeDef status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, reinterpret_cast<uintptr_t>(address), word);
+    HAL_FLASH_Lock();
+    return status == HAL_OK && *address == word;
+}
+
+journal_flash journal_flash_internal() noexcept
+{
+    return { { JOURNAL_Sectors, JOURNAL_Sectors + kJournalSectorWords }, kJournalSectorWords, JOURNAL_Erase, JOURNAL_Program };
+}
+#endif
@@ -0,0 +1,51 @@
+#include "i2c.h"
+
+#include "lm75a.h"
+#include "zlg7290.h"
+
+uint8_t I2C_IsHealthy(void)
+{
+    if (HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY || __HAL_I2C_GET_FLAG(&hi2c1, I2C_FLAG_BUSY))
+        return 0;
+    return HAL_I2C_IsDeviceReady(&hi2c1, ZLG7290_SLVAEADDR, 2, 10) == HAL_OK
+        && HAL_I2C_IsDeviceReady(&hi2c1, LM75A_SLAVEADDR, 2, 10) == HAL_OK;
+}
+
+// A slave cut off in the middle of a read can hold SDA low forever, clock it out of the
+// byte by hand and finish with a stop condition
+static void I2C_ReleaseBus(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = I2C_SCL_PIN | I2C_SDA_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    HAL_GPIO_WritePin(I2C_GPIO_PORT, I2C_SCL_PIN | I2C_SDA_PIN, GPIO_PIN_SET);
+    HAL_GPIO_Init(I2C_GPIO_PORT, &GPIO_InitStruct);
+
+    for (uint32_t i = 0; i < 9 && HAL_GPIO_ReadPin(I2C_GPIO_PORT, I2C_SDA_PIN) == GPIO_PIN_RESET; ++i)
+    {
+        HAL_GPIO_WritePin(I2C_GPIO_PORT, I2C_SCL_PIN, GPIO_PIN_RESET);
+        HAL_Delay(1);
+        HAL_GPIO_WritePin(I2C_GPIO_PORT, I2C_SCL_PIN, GPIO_PIN_SET);
+        HAL_Delay(1);
+    }
+
+    HAL_GPIO_WritePin(I2C_GPIO_PORT, I2C_SDA_PIN, GPIO_PIN_RESET);
+    HAL_Delay(1);
+    HAL_GPIO_WritePin(I2C_GPIO_PORT, I2C_SDA_PIN, GPIO_PIN_SET);
+}
+
+HAL_StatusTypeDef I2C_Recover(void)
+{
+    HAL_I2C_DeInit(&hi2c1);
+    I2C_ReleaseBus();
+
+    // The BUSY flag may stay set after a glitch on the lines, only a software reset clears it
+    __HAL_RCC_I2C1_CLK_ENABLE();
+    SET_BIT(hi2c1.Instance->CR1, I2C_CR1_SWRST);
+    CLEAR_BIT(hi2c1.Instance->CR1, I2C_CR1_SWRST);
+
+    // The MSP init puts the pins back into their alternate function
+    return HAL_I2C_Init(&hi2c1);
+}
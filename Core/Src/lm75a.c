@@ -4,10 +4,10 @@
 
 uint8_t LM75A_SetMode(uint8_t reg, uint8_t mode)
 {
-	if (HAL_I2C_Mem_Write(&hi2c1, 0x9F, reg, 1, &mode, 1, 100) == HAL_OK)
+	if (HAL_I2C_Mem_Write(&hi2c1, LM75A_SLAVEADDR, reg, 1, &mode, 1, 100) == HAL_OK)
 	{
 		uint8_t tmp;
-		if (HAL_I2C_Mem_Read(&hi2c1, 0x9F, reg, 1, &tmp, 1, 100) == HAL_OK && (tmp && mode) == mode)
+		if (HAL_I2C_Mem_Read(&hi2c1, LM75A_SLAVEADDR, reg, 1, &tmp, 1, 100) == HAL_OK && (tmp && mode) == mode)
 			return (uint8_t)LM75A_RESULT_OK;
 	}
 
@@ -17,7 +17,7 @@ uint8_t LM75A_SetMode(uint8_t reg, uint8_t mode)
 lm75a_temp_t LM75A_GetTemp()
 {
 	uint8_t temp[2];
-	if (HAL_I2C_Mem_Read(&hi2c1, 0x9F, LM75A_ADDR_TEMP, 2, temp, 2, 100) == HAL_OK)
+	if (HAL_I2C_Mem_Read(&hi2c1, LM75A_SLAVEADDR, LM75A_ADDR_TEMP, 2, temp, 2, 100) == HAL_OK)
 	{
 		lm75a_temp_t result = temp[1];
 		result |= (temp[0] << 8);
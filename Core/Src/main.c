@@ -26,6 +26,12 @@
 #include "zlg7290.h"
 
 #include "sm.h"
+#include "trace.h"
+
+#ifdef BENCHMARK
+#include "dwt.h"
+#include "bench.h"
+#endif
 
 /* USER CODE END Includes */
 
@@ -47,12 +53,16 @@
 /* Private variables ---------------------------------------------------------*/
 CRC_HandleTypeDef hcrc;
 
+DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+
 I2C_HandleTypeDef hi2c1;
 
 IWDG_HandleTypeDef hiwdg;
 
 RNG_HandleTypeDef hrng;
 
+TIM_HandleTypeDef htim6;
+
 UART_HandleTypeDef huart1;
 
 /* USER CODE BEGIN PV */
@@ -62,11 +72,13 @@ UART_HandleTypeDef huart1;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_CRC_Init(void);
 static void MX_IWDG_Init(void);
 static void MX_RNG_Init(void);
+static void MX_TIM6_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -85,7 +97,17 @@ int main(void)
 
   /* USER CODE BEGIN 1 */
   extern void Boostrap();
+  extern uint8_t Bootstrap_IsWarmBoot();
+#ifdef BENCHMARK
+  // Not cleared, the post-mortem trace reads the counter across reset jumps
+  DWT_Enable();
+  BENCH_Boot.main_cycles = DWT_GetCycles();
   Boostrap();
+  BENCH_Boot.bootstrap_cycles = DWT_GetCycles() - BENCH_Boot.main_cycles;
+  BENCH_Boot.warm = Bootstrap_IsWarmBoot();
+#else
+  Boostrap();
+#endif
   
   /* USER CODE END 1 */
 
@@ -103,21 +125,42 @@ int main(void)
 
   /* USER CODE BEGIN SysInit */
 
-  // Delay for hardware reset
-  HAL_Delay(50);
+  // Delay for hardware reset, a warm boot did not reset the devices
+  if (!Bootstrap_IsWarmBoot())
+    HAL_Delay(50);
   
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_I2C1_Init();
   MX_USART1_UART_Init();
   MX_CRC_Init();
   MX_IWDG_Init();
   MX_RNG_Init();
+  MX_TIM6_Init();
   /* USER CODE BEGIN 2 */
-  
+#ifdef BENCHMARK
+  // Only after a cold boot, the gap of a reset jump in BENCH_Boot.service_cycles must
+  // not include them. They write into the sealed sections, the seal is checked before
+  // them and renewed after them when it held, so SM_Init sees what the reset left.
+  if (!Bootstrap_IsWarmBoot())
+  {
+    extern uint8_t Bootstrap_CheckSeal();
+    extern void Bootstrap_SealSections();
+    const uint8_t sealed = Bootstrap_CheckSeal();
+    BENCH_Run();
+    if (sealed)
+      Bootstrap_SealSections();
+  }
+  const uint32_t sm_init_start = DWT_GetCycles();
+  SM_Init();
+  BENCH_Boot.sm_init_cycles = DWT_GetCycles() - sm_init_start;
+#else
   SM_Init();
+#endif
+  App_Loop();
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -127,10 +170,6 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
-#ifndef DEBUG
-    HAL_IWDG_Refresh(&hiwdg);
-#endif
-    SM_Run();
   }
   /* USER CODE END 3 */
 }
@@ -297,6 +336,44 @@ static void MX_RNG_Init(void)
 
 }
 
+/**
+  * @brief TIM6 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM6_Init(void)
+{
+
+  /* USER CODE BEGIN TIM6_Init 0 */
+
+  /* USER CODE END TIM6_Init 0 */
+
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+  /* USER CODE BEGIN TIM6_Init 1 */
+
+  /* USER CODE END TIM6_Init 1 */
+  htim6.Instance = TIM6;
+  htim6.Init.Prescaler = 83;
+  htim6.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim6.Init.Period = 1999;
+  htim6.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
+  if (HAL_TIM_Base_Init(&htim6) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim6, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM6_Init 2 */
+
+  /* USER CODE END TIM6_Init 2 */
+
+}
+
 /**
   * @brief USART1 Initialization Function
   * @param None
@@ -330,6 +407,43 @@ static void MX_USART1_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  * Configure DMA for memory to memory transfers
+  *   hdma_memtomem_dma2_stream0
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA2_CLK_ENABLE();
+
+  /* Configure DMA request hdma_memtomem_dma2_stream0 on DMA2_Stream0 */
+  hdma_memtomem_dma2_stream0.Instance = DMA2_Stream0;
+  hdma_memtomem_dma2_stream0.Init.Channel = DMA_CHANNEL_0;
+  hdma_memtomem_dma2_stream0.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  hdma_memtomem_dma2_stream0.Init.PeriphInc = DMA_PINC_ENABLE;
+  hdma_memtomem_dma2_stream0.Init.MemInc = DMA_MINC_DISABLE;
+  hdma_memtomem_dma2_stream0.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  hdma_memtomem_dma2_stream0.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  hdma_memtomem_dma2_stream0.Init.Mode = DMA_NORMAL;
+  hdma_memtomem_dma2_stream0.Init.Priority = DMA_PRIORITY_LOW;
+  hdma_memtomem_dma2_stream0.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+  hdma_memtomem_dma2_stream0.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+  hdma_memtomem_dma2_stream0.Init.MemBurst = DMA_MBURST_SINGLE;
+  hdma_memtomem_dma2_stream0.Init.PeriphBurst = DMA_PBURST_SINGLE;
+  if (HAL_DMA_Init(&hdma_memtomem_dma2_stream0) != HAL_OK)
+  {
+    Error_Handler( );
+  }
+
+  /* DMA interrupt init */
+  /* DMA2_Stream0_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -387,6 +501,49 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+// The main loop, entered from main and again with an empty stack by App_Restart
+void App_Loop(void)
+{
+  while (1)
+  {
+#ifndef DEBUG
+    HAL_IWDG_Refresh(&hiwdg);
+#endif
+    SM_Run();
+  }
+}
+
+// Interrupt sources of the peripherals, each enabled again by its MX_* init call
+static const IRQn_Type App_Interrupts[] =
+{
+  TIM6_DAC_IRQn, I2C1_EV_IRQn, I2C1_ER_IRQn, USART1_IRQn, DMA2_Stream0_IRQn, EXTI15_10_IRQn,
+};
+
+// The startup code clears the handles the interrupt handlers use, so a jump into Reset_Handler
+// must leave no peripheral interrupt running or pending. SysTick stays on for HAL_Delay.
+void App_Quiesce(void)
+{
+  // Either may be called before its MX_* init call
+  if (htim6.Instance != NULL)
+    BEEP_Stop();
+  if (hi2c1.Instance != NULL && HAL_I2C_GetState(&hi2c1) != HAL_I2C_STATE_READY)
+    HAL_I2C_Master_Abort_IT(&hi2c1, 0);
+  for (uint32_t i = 0; i < sizeof(App_Interrupts) / sizeof(App_Interrupts[0]); i++)
+  {
+    HAL_NVIC_DisableIRQ(App_Interrupts[i]);
+    HAL_NVIC_ClearPendingIRQ(App_Interrupts[i]);
+  }
+}
+
+// Drops every frame on the stack and enters App_Loop from the top of it
+__attribute__((naked)) void App_Restart(void)
+{
+  __asm volatile(
+    "ldr r0, =_estack\n"
+    "msr msp, r0\n"
+    "isb\n"
+    "b App_Loop\n");
+}
 /* USER CODE END 4 */
 
 /**
@@ -396,10 +553,12 @@ static void MX_GPIO_Init(void)
 void Error_Handler(void)
 {
   /* USER CODE BEGIN Error_Handler_Debug */
+  TRACE_Record(TRACE_STATE_NONE, TRACE_REASON_ERROR_HANDLER);
 
   // Try to restart the system if an error occurs
   // TODO: Try to not lose the current state
   extern void Reset_Handler();
+  App_Quiesce();
   Reset_Handler();
 
   /* User can add his own implementation to report the HAL error return state */
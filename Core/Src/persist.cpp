@@ -0,0 +1,14 @@
+#include "persist.hpp"
+
+#include "stm32f4xx_hal.h"
+
+persist_region persist_bkpsram() noexcept
+{
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_BKPSRAM_CLK_ENABLE();
+    // Without the regulator BKPSRAM is only kept across resets, not on VBAT
+    if (HAL_PWREx_EnableBkUpReg() != HAL_OK)
+        return { nullptr, 0 };
+    return { reinterpret_cast<volatile uint32_t*>(BKPSRAM_BASE), 4096 / sizeof(uint32_t) };
+}
@@ -0,0 +1,72 @@
+#include "scrub.hpp"
+
+#include "stm32f4xx_hal.h"
+
+extern "C" const scrub_entry _sscrub[];
+extern "C" const scrub_entry _escrub[];
+
+SCRUB_Statistics SCRUB_Stats;
+
+constexpr uint32_t kSlotPeriod = SCRUB_SLOT_PERIOD_MS;
+
+static uint32_t SCRUB_Next;
+static uint32_t SCRUB_SlotTick;
+static uint32_t SCRUB_SweepTick;
+
+static void SCRUB_Entry(const scrub_entry& entry)
+{
+    switch (entry.scrub())
+    {
+    case SCRUB_CLEAN:
+        break;
+    case SCRUB_REPAIRED:
+        ++SCRUB_Stats.repairs;
+        break;
+    case SCRUB_LOST:
+        ++SCRUB_Stats.lost;
+        break;
+    }
+}
+
+void SCRUB_Step()
+{
+    const uint32_t entries = _escrub - _sscrub;
+    if (entries == 0)
+        return;
+
+    const uint32_t current_tick = HAL_GetTick();
+    if (SCRUB_Stats.entries == 0)
+    {
+        SCRUB_Stats.entries = entries;
+        SCRUB_Stats.records_per_slot = SCRUB_RECORDS_PER_SLOT;
+        SCRUB_Stats.slot_period_ms = kSlotPeriod;
+        SCRUB_Stats.latency_bound_ms = kSlotPeriod == 0
+            ? SCRUB_LATENCY_UNBOUNDED
+            : (entries + SCRUB_RECORDS_PER_SLOT - 1) / SCRUB_RECORDS_PER_SLOT * kSlotPeriod;
+        SCRUB_SweepTick = current_tick;
+    }
+    else if (current_tick - SCRUB_SlotTick < kSlotPeriod)
+        return;
+    SCRUB_SlotTick = current_tick;
+
+    for (uint32_t i = 0; i < SCRUB_RECORDS_PER_SLOT; ++i)
+    {
+        SCRUB_Entry(_sscrub[SCRUB_Next]);
+        if (++SCRUB_Next < entries)
+            continue;
+        // A whole sweep is done, every record has been checked once since its start
+        SCRUB_Next = 0;
+        ++SCRUB_Stats.sweeps;
+        SCRUB_Stats.last_sweep_ms = current_tick - SCRUB_SweepTick;
+        if (SCRUB_Stats.last_sweep_ms > SCRUB_Stats.max_sweep_ms)
+            SCRUB_Stats.max_sweep_ms = SCRUB_Stats.last_sweep_ms;
+        SCRUB_SweepTick = current_tick;
+        break;
+    }
+}
+
+void SCRUB_All()
+{
+    for (const scrub_entry* entry = _sscrub; entry != _escrub; ++entry)
+        SCRUB_Entry(*entry);
+}
@@ -1,36 +1,231 @@
 #include "sm.h"
 
+#include <array>
+#include <initializer_list>
+#include <iterator>
+#include <string.h>
+
 #include "backup_data.hpp"
+#include "cfcss.hpp"
+#include "voted_data.hpp"
 
 #include "main.h"
+#include "console.h"
 #include "i2c.h"
 #include "lm75a.h"
 #include "beep.h"
+#include "trace.h"
 #include "zlg7290.h"
 
-BACKUP(uint32_t, SM_ResetJumpBack);
-BACKUP(uint32_t, SM_Inititalized);
-BACKUP(uint32_t, SM_Operation);
+#ifdef PERSIST_BKPSRAM
+#include "persist.hpp"
+#endif
+#ifdef PERSIST_FLASH
+#include "flash_journal.hpp"
+#endif
+
+#ifdef SM_USE_TASKS
+#include "tasks.hpp"
+#endif
+
+#include "dwt.h"
+#ifdef BENCHMARK
+#include <inttypes.h>
+
+#include "bench.h"
+#include "cycle_profile.hpp"
+#endif
+
+// Cycle budget of one SM_Run call. States are chained until the budget runs out or the next
+// state waits, 0 runs exactly one state per call. The budget is checked between states, so
+// a call may overrun it by one state, keep it well below the watchdog window.
+#ifndef SM_RUN_BUDGET_CYCLES
+#define SM_RUN_BUDGET_CYCLES 0
+#endif
+
+constexpr uint32_t SM_TEMPERATURE_LOW_INIT = 25 * 8 * 1000;
+constexpr uint32_t SM_TEMPERATURE_HIGH_INIT = 35 * 8 * 1000;
+
+enum
+{
+    SM_EDIT_IS_EDITING, // 0: not editing, 1: editing
+    SM_EDIT_CURSOR_POS, // ranges in [0, 5]
+    SM_EDIT_TARGET, // 0: low temperature, 1: high temperature
+    SM_EDIT_TEMPERATE, // ranges in [0, 999999]
+};
+// Small enough to share a single word with the edit flags
+using SM_EditContext = bitfield<1, 3, 1, 20>;
+#define SM_EDIT_CONTEXT_INIT SM_EditContext::pack(0u, 0u, 0u, 0u)
+
+enum
+{
+    SM_EDIT_STATE_CONTEXT, // packed SM_EditContext
+    SM_EDIT_STATE_LOW, // current lowest temperature
+    SM_EDIT_STATE_HIGH, // current highest temperature
+};
+// Leaving the edit mode saves a threshold, so both are committed together
+using SM_EditStateJournal = critical_journal<critical_record<uint32_t, uint32_t, uint32_t>>;
+#define SM_EDIT_STATE_INIT SM_EDIT_CONTEXT_INIT, SM_TEMPERATURE_LOW_INIT, SM_TEMPERATURE_HIGH_INIT
+
+enum
+{
+    SM_CONTROL_OPERATION, // current state
+    SM_CONTROL_RESET_JUMP_BACK, // state to resume after a reset jump
+    SM_CONTROL_INITIALIZED, // 0: defaults not set yet, 1: initialized
+};
+using SM_ControlRecord = critical_bitfield<5, 5, 1>;
+#define SM_CONTROL_INIT 0u, 0u, 0u
+
+BACKUP_AS(SM_ControlRecord, SM_Control, critical_image, SM_CONTROL_INIT);
+// A key press waiting for the keypad, kept apart from the words the state machine updates
 BACKUP(uint32_t, KeyPressed);
 BACKUP(uint32_t, KeyData);
 BACKUP(uint32_t, KeyNum);
-BACKUP(uint32_t, TemperatureLow); // current lowest temperature
-BACKUP(uint32_t, TemperatureHigh); // current highest temperature
-BACKUP(uint32_t, TemperatureCurrent); // current temperature
-BACKUP(uint32_t, IsEditing); // 0: not editing, 1: editing
-BACKUP(uint32_t, CursorPos); // ranges in [0, 5]
-BACKUP(uint32_t, EditTarget); // 0: low temperature, 1: high temperature
-BACKUP(uint32_t, EditTemperate); // ranges in [0, 999999]
+BACKUP(uint32_t, TemperatureCurrent, (SM_TEMPERATURE_LOW_INIT + SM_TEMPERATURE_HIGH_INIT) / 2); // current temperature
+BACKUP_AS(SM_EditStateJournal, EditState, critical_image, SM_EDIT_STATE_INIT);
 BACKUP(uint32_t, TemperatureHandleTick);
-BACKUP(uint32_t, LastStep);
-BACKUP(uint32_t, LastResetTick);
+// Read on every pass, so it is voted instead of crc checked
+VOTED(uint32_t, LastResetTick);
 
-constexpr uint32_t SM_TEMPERATURE_LOW_INIT = 25 * 8 * 1000;
-constexpr uint32_t SM_TEMPERATURE_HIGH_INIT = 35 * 8 * 1000;
+enum
+{
+    SM_FRAME_DIGITS_0, // digits 0 to 3 as written to DPRAM0, one byte each
+    SM_FRAME_DIGITS_4, // digits 4 to 7
+    SM_FRAME_FLASH, // flash mask of the last flash command
+};
+// Copy of what the ZLG7290 shows, so a warm boot restores the display without redrawing it
+using SM_FrameRecord = critical_record<uint32_t, uint32_t, uint32_t>;
+constexpr uint32_t SM_FRAME_DASHES = ZLG7290_DISPLAY_MIDDLE * 0x01010101u;
+#define SM_FRAME_INIT SM_FRAME_DASHES, SM_FRAME_DASHES, 0u
+BACKUP_AS(SM_FrameRecord, Framebuffer, critical_image, SM_FRAME_INIT);
+
+// Set by the key interrupt, which must not use the crc unit while a DMA stream may be feeding
+// it to seal the sections, and moved into KeyPressed in thread mode
+static volatile bool SM_KeyInterrupt;
+
+static void SM_LatchKey()
+{
+    if (!SM_KeyInterrupt)
+        return;
+    SM_KeyInterrupt = false;
+    BACKUP_SET(KeyPressed, 1);
+}
+
+#ifdef PERSIST_BKPSRAM
+// Committed edit context and thresholds, mirrored into BKPSRAM so a power-on reset
+// restores the configured range instead of falling back to the defaults
+using SM_EditStateMirror = persist_mirror<3>;
+static SM_EditStateMirror SM_EditStatePersist{ persist_region{} };
+
+static void SM_PersistEditState()
+{
+    SM_EditStatePersist.save({
+        EditState.get<SM_EDIT_STATE_CONTEXT>(),
+        EditState.get<SM_EDIT_STATE_LOW>(),
+        EditState.get<SM_EDIT_STATE_HIGH>() });
+}
+
+static bool SM_RestoreEditState()
+{
+    SM_EditStateMirror::words_t words;
+    if (!SM_EditStatePersist.load(words) || words[SM_EDIT_STATE_LOW] > words[SM_EDIT_STATE_HIGH])
+        return false;
+    BACKUP_SET(EditState, words[SM_EDIT_STATE_CONTEXT], words[SM_EDIT_STATE_LOW], words[SM_EDIT_STATE_HIGH]);
+    return true;
+}
+#endif
+
+#ifdef PERSIST_FLASH
+// Configuration kept in the flash journal, survives a power-on reset without VBAT
+enum
+{
+    SM_JOURNAL_TEMPERATURE_LOW,
+    SM_JOURNAL_TEMPERATURE_HIGH,
+    SM_JOURNAL_KEYS,
+};
+using SM_ConfigJournal = flash_journal<SM_JOURNAL_KEYS>;
+static SM_ConfigJournal SM_Journal{ journal_flash{} };
+
+static void SM_JournalThresholds()
+{
+    SM_Journal.set(SM_JOURNAL_TEMPERATURE_LOW, EditState.get<SM_EDIT_STATE_LOW>());
+    SM_Journal.set(SM_JOURNAL_TEMPERATURE_HIGH, EditState.get<SM_EDIT_STATE_HIGH>());
+}
+
+static void SM_RestoreJournal()
+{
+    uint32_t low, high;
+    if (SM_Journal.get(SM_JOURNAL_TEMPERATURE_LOW, low) && SM_Journal.get(SM_JOURNAL_TEMPERATURE_HIGH, high) && low <= high)
+        BACKUP_SET(EditState, SM_EDIT_CONTEXT_INIT, low, high);
+}
+#endif
+
+// Reasons to run a pass, set from interrupts and by the states, each cleared by the state
+// that handles it. SM_Run sleeps at the start of a pass while none is pending. With
+// SM_USE_TASKS they wake the task waiting for them instead.
+enum
+{
+    SM_EVENT_KEY = 1u << 0, // key interrupt
+    SM_EVENT_TEMP_TICK = 1u << 1, // temperature reading due
+    SM_EVENT_ALARM = 1u << 2, // temperature out of range
+    SM_EVENT_DISPLAY = 1u << 3, // edit state changed, display not updated yet
+    SM_EVENT_HOUSEKEEPING = 1u << 4, // idle slot for the scrubber and the console
+};
+// Tick the next temperature reading is due, the first one right after start
+static volatile uint32_t SM_TemperatureDue;
+
+constexpr uint32_t SM_TEMPERATURE_DELAY = 5000;
+constexpr uint32_t SM_HOUSEKEEPING_PERIOD = 10;
+
+constexpr uint32_t SM_KEY_RETRY_DELAY = 20;
+constexpr uint32_t SM_BEEP_DURATION = 1000;
+
+#ifdef SM_USE_TASKS
+// I2C1 is shared by the sensor, keypad and display tasks, one transfer at a time
+static task_lock SM_Bus;
+
+static void SM_Signal(uint32_t events)
+{
+    TASKS_Signal(events);
+}
+
+static void SM_Take(uint32_t events)
+{
+    TASKS_Take(events);
+}
+
+static bool SM_Pending()
+{
+    return TASKS_Ready();
+}
+#else
+static volatile uint32_t SM_Events;
+
+static void SM_Signal(uint32_t events)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    SM_Events = SM_Events | events;
+    __set_PRIMASK(primask);
+}
+
+static void SM_Take(uint32_t events)
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    SM_Events = SM_Events & ~events;
+    __set_PRIMASK(primask);
+}
+
+static bool SM_Pending()
+{
+    return SM_Events != 0;
+}
+#endif
 
-#define SM_CASE(x) case x: SM_Operation = _##x(); break
 #define SM_STATE(x) static uint32_t _##x()
 
+// Tools/trace_decode.py names the traced states by these numbers
 enum
 {
     SM_OPT_IS_EDITING,
@@ -50,72 +245,304 @@ enum
     SM_OPT_SAVE_AND_EXIT_EDIT,
     SM_OPT_UPDATE_DISPLAY,
     SM_OPT_RESETHANDLER,
+    SM_OPT_COUNT,
+};
+static_assert(SM_OPT_COUNT <= (1u << SM_ControlRecord::layout::width<SM_CONTROL_OPERATION>()));
+static_assert(SM_OPT_COUNT <= 32, "successor sets are 32 bit masks");
+
+// Control flow signature of every state, the register holds the one of the state allowed to run next
+constexpr std::array<uint32_t, SM_OPT_COUNT> SM_StateSignatures = cfcss_signatures<SM_OPT_COUNT>();
+static_assert(cfcss_min_distance(SM_StateSignatures) >= 8, "a few flipped bits must not turn one signature into another");
+__attribute__((section(BACKUP_SECTION_PRIMARY))) constinit cfcss_register SM_FlowSignature{critical_image, SM_StateSignatures[SM_OPT_IS_EDITING]};
+
+#ifdef BENCHMARK
+// Cost of the last complete key press, from READ_KEY_INPUT to UPDATE_DISPLAY
+struct SM_KeyPathBenchmark
+{
+    uint32_t passes;
+    uint32_t cycles;
+    uint32_t crc_runs;
+    uint32_t crc_cycles;
+    uint32_t cache_hits;
+};
+SM_KeyPathBenchmark SM_KeyPath;
+static SM_KeyPathBenchmark SM_KeyPathCurrent;
+static bool SM_KeyPathActive;
+
+// Replica writes and crc runs over the last second, mostly idle READ_KEY_INPUT passes,
+// and the share of that second the core spent asleep waiting for an event
+struct SM_IdleRatesBenchmark
+{
+    uint32_t writes_per_second;
+    uint32_t crc_runs_per_second;
+    uint32_t sleeps_per_second;
+    uint32_t idle_permille;
+};
+SM_IdleRatesBenchmark SM_IdleRates;
+static uint32_t SM_IdleRatesTick;
+static uint32_t SM_IdleRatesWrites;
+static uint32_t SM_IdleRatesCrcRuns;
+static uint32_t SM_IdleRatesCycles;
+static uint32_t SM_IdleRatesSleeps;
+// CYCCNT may stop while the core sleeps, so the active time is the counter over the window
+// less what it counted inside WFI, right either way
+static uint32_t SM_IdleRatesSleepCycles;
+
+// Cycles of every SM_Step, guard, state and successor check included
+struct SM_StepBenchmark
+{
+    uint32_t steps;
+    uint32_t cycles;
+    uint32_t max_cycles;
 };
+SM_StepBenchmark SM_Steps;
+
+// Cycles of the state function alone, per state. In CCMRAM with no flash image, which the startup
+// code neither copies nor zeroes, so SM_Init clears it once and it then adds up across reset jumps.
+__attribute__((section(".ccm_noinit"))) cycle_profile<SM_OPT_COUNT> SM_Profile;
+
+constexpr const char* SM_StateNames[] =
+{
+    "IS_EDITING",
+    "CHECK_TEMPTICK",
+    "READTEMP",
+    "IS_TEMP_IN_RANGE",
+    "TEMP_OUT_OF_RANGE",
+    "READ_KEY_INPUT",
+    "READ_KEY_DELAY",
+    "ON_KEY_PRESSED",
+    "UPDATE_KEYNUM",
+    "SWITCH_TARGET_LOW",
+    "SWITCH_TARGET_HIGH",
+    "MOVE_CURSOR_LEFT",
+    "MOVE_CURSOR_RIGHT",
+    "SWITCH_EDIT_MODE",
+    "SAVE_AND_EXIT_EDIT",
+    "UPDATE_DISPLAY",
+    "RESETHANDLER",
+};
+static_assert(std::size(SM_StateNames) == SM_OPT_COUNT, "a state without a name");
+
+// States chained per SM_Run call, and the time from the key interrupt until the display shows the key
+struct SM_RunBenchmark
+{
+    uint32_t calls;
+    uint32_t states;
+    uint32_t last_states;
+    uint32_t max_states;
+    uint32_t key_latency_cycles;
+    uint32_t max_key_latency_cycles;
+};
+SM_RunBenchmark SM_Runs;
+static volatile uint32_t SM_KeyInterruptCycles;
+
+static void SM_RecordKeyLatency(uint32_t end_cycles)
+{
+    SM_Runs.key_latency_cycles = end_cycles - SM_KeyInterruptCycles;
+    if (SM_Runs.key_latency_cycles > SM_Runs.max_key_latency_cycles)
+        SM_Runs.max_key_latency_cycles = SM_Runs.key_latency_cycles;
+}
+
+// Service gap of the last soft rejuvenation, from the decision to the next SM_Run on the
+// fresh stack. The gap of a reset jump is BENCH_Boot.service_cycles of a warm boot.
+struct SM_RejuvenationBenchmark
+{
+    uint32_t soft_count;
+    uint32_t soft_gap_cycles;
+    uint32_t max_soft_gap_cycles;
+    uint32_t i2c_recoveries;
+};
+SM_RejuvenationBenchmark SM_Rejuvenations;
+static bool SM_ServicePending = true;
+static bool SM_SoftGapPending;
+static uint32_t SM_SoftGapStart;
+
+#ifdef PERSIST_BKPSRAM
+// Cost of restoring the edit state from BKPSRAM on the last fresh start
+struct SM_PersistBenchmark
+{
+    uint32_t restored;
+    uint32_t restore_cycles;
+};
+SM_PersistBenchmark SM_PersistRestore;
+#endif
+
+#ifdef PERSIST_FLASH
+// Cost of mounting the flash journal on the last start
+struct SM_JournalBenchmark
+{
+    uint32_t mount_cycles;
+    uint32_t mount_records;
+};
+SM_JournalBenchmark SM_JournalMount;
+#endif
+#endif
+
+extern "C" void Bootstrap_InitCriticalData();
+extern "C" void Boostrap_InitBackupData();
+extern "C" void Bootstrap_SealSections();
+extern "C" uint8_t Bootstrap_CheckSeal();
+extern "C" uint8_t Bootstrap_IsRestored();
+
+static void SM_Resume(uint32_t state);
+#ifdef SM_USE_TASKS
+static void SM_StartTasks();
+#endif
+
+struct SM_Frame
+{
+    uint8_t digits[8];
+    uint8_t flash;
+};
+
+static SM_Frame SM_CachedFrame()
+{
+    SM_Frame frame;
+    const uint32_t words[2] = { Framebuffer.get<SM_FRAME_DIGITS_0>(), Framebuffer.get<SM_FRAME_DIGITS_4>() };
+    memcpy(frame.digits, words, sizeof(frame.digits));
+    frame.flash = static_cast<uint8_t>(Framebuffer.get<SM_FRAME_FLASH>());
+    return frame;
+}
+
+static bool SM_WriteFrame(SM_Frame& frame, uint32_t first, uint32_t last, bool flash)
+{
+    bool written = first >= last || ZLG7290_Write(&hi2c1, ZLG7290_ADDR_DPRAM0 + first, frame.digits + first, last - first) == HAL_OK;
+    if (flash)
+    {
+        uint8_t cmd[2];
+        cmd[0] = 0b01110000;
+        cmd[1] = frame.flash;
+        written = ZLG7290_Write(&hi2c1, ZLG7290_ADDR_CMDBUF0, cmd, sizeof(cmd)) == HAL_OK && written;
+    }
+    return written;
+}
+
+static void SM_CacheFrame(const SM_Frame& frame)
+{
+    uint32_t words[2];
+    memcpy(words, frame.digits, sizeof(words));
+    BACKUP_SET(Framebuffer, words[0], words[1], static_cast<uint32_t>(frame.flash));
+}
+
+// Span of digits [first, last) that differs from the cached frame, and whether the flash
+// mask does. All of it when the cache is corrupted.
+static void SM_FrameChanges(const SM_Frame& frame, uint32_t& first, uint32_t& last, bool& flash)
+{
+    first = 0;
+    last = sizeof(frame.digits);
+    flash = true;
+    if (BACKUP_IS_VALID(Framebuffer))
+    {
+        const SM_Frame shown = SM_CachedFrame();
+        while (first < last && frame.digits[first] == shown.digits[first])
+            ++first;
+        while (last > first && frame.digits[last - 1] == shown.digits[last - 1])
+            --last;
+        flash = frame.flash != shown.flash;
+    }
+}
+
+// Every digit costs a bus write and 5ms, so only the span that differs from the cached frame
+// is written. The cache is left alone when a write fails, the next frame writes that span again.
+static void SM_ShowFrame(SM_Frame frame)
+{
+    uint32_t first, last;
+    bool flash;
+    SM_FrameChanges(frame, first, last, flash);
+    if (SM_WriteFrame(frame, first, last, flash))
+        SM_CacheFrame(frame);
+}
+
+// Brings the display in line with the cached frame. One read of the digits is far cheaper than
+// writing them, so a display that kept its content through the reset is not written at all.
+static void SM_RestoreDisplay()
+{
+    if (!BACKUP_IS_VALID(Framebuffer))
+        BACKUP_SET(Framebuffer, SM_FRAME_INIT);
+    SM_Frame frame = SM_CachedFrame();
+    uint8_t shown[sizeof(frame.digits)];
+    if (ZLG7290_Read(&hi2c1, ZLG7290_ADDR_DPRAM0, shown, sizeof(shown)) == HAL_OK && memcmp(shown, frame.digits, sizeof(shown)) == 0)
+        return;
+    SM_WriteFrame(frame, 0, sizeof(frame.digits), true);
+}
 
 void SM_Init()
 {
-    if (BACKUP_IS_VALID(SM_Inititalized))
+    // The sections are left exactly as they were before a reset jump unless the
+    // seal fails, then every variable is checked and repaired before being trusted
+    if constexpr (SM_RUN_BUDGET_CYCLES != 0)
+        DWT_Enable();
+#ifdef BENCHMARK
+    if (!SM_Profile.valid())
+        SM_Profile.clear();
+#endif
+#ifdef DEBUG
+    // Keep the debug port clocked while the loop sleeps in WFI
+    HAL_DBGMCU_EnableDBGSleepMode();
+#endif
+
+    const bool sealed = Bootstrap_CheckSeal();
+    critical_epoch::advance();
+    if (!sealed)
+        SCRUB_All();
+#ifdef PERSIST_BKPSRAM
+    SM_EditStatePersist = SM_EditStateMirror{ persist_bkpsram() };
+#endif
+#ifdef PERSIST_FLASH
+    SM_Journal = SM_ConfigJournal{ journal_flash_internal() };
+#ifdef BENCHMARK
+    const uint32_t mount_start = DWT_GetCycles();
+    SM_Journal.mount();
+    SM_JournalMount.mount_cycles = DWT_GetCycles() - mount_start;
+    SM_JournalMount.mount_records = SM_Journal.stats().mount_records;
+#else
+    SM_Journal.mount();
+#endif
+#endif
+
+    uint32_t sm_initialized;
+    BACKUP_FIELD_GET(SM_Control, SM_CONTROL_INITIALIZED, sm_initialized);
+    if (BACKUP_IS_VALID(SM_Control) && sm_initialized)
     {
-        uint32_t sm_initialized;
-        BACKUP_GET(SM_Inititalized, sm_initialized);
-        if (sm_initialized)
-        {
-            if (BACKUP_IS_VALID(SM_ResetJumpBack))
-            {
-                uint32_t jmp_back;
-                BACKUP_GET(SM_ResetJumpBack, jmp_back);
-                SM_Operation = jmp_back;
-            }
-            return;
-        }
+        SM_Resume(SM_Control.get<SM_CONTROL_RESET_JUMP_BACK>());
+        SM_RestoreDisplay();
+#ifdef SM_USE_TASKS
+        SM_StartTasks();
+#endif
+        return;
     }
         
-    do
-    {
-        BACKUP_SET(TemperatureHandleTick, 0);
-        BACKUP_SET(TemperatureLow, SM_TEMPERATURE_LOW_INIT);
-        BACKUP_SET(TemperatureHigh, SM_TEMPERATURE_HIGH_INIT);
-        BACKUP_SET(TemperatureCurrent, (TemperatureLow + TemperatureHigh) / 2);
-    } while (
-        !BACKUP_IS_VALID(TemperatureHandleTick) || 
-        !BACKUP_IS_VALID(TemperatureLow) || 
-        !BACKUP_IS_VALID(TemperatureHigh) || 
-        !BACKUP_IS_VALID(TemperatureCurrent)
-    );
-
-    do
-    {
-        IsEditing = 0;
-        CursorPos = 0;
-        EditTarget = 0;
-        EditTemperate = 0;
-    } while (
-        !BACKUP_IS_VALID(IsEditing) || 
-        !BACKUP_IS_VALID(CursorPos) || 
-        !BACKUP_IS_VALID(EditTarget) || 
-        !BACKUP_IS_VALID(EditTemperate)
-    );
-
-    // Stop flash
-    uint8_t cmd[2];
-    cmd[0] = 0b01110000;
-    cmd[1] = 0b00000000;
-    ZLG7290_Write(&hi2c1, ZLG7290_ADDR_CMDBUF0, cmd, sizeof(cmd));
-
-    // Init display
-    uint8_t display[8] = 
-    {
-        ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-        ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-        ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-        ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE
-    };
-    ZLG7290_Write(&hi2c1, ZLG7290_ADDR_DPRAM0, display, sizeof(display));
+    // Every variable above has a valid default image in flash, restoring them replaces
+    // seeding the defaults one by one. A power-on boot has just done it in Boostrap.
+    if (!Bootstrap_IsRestored())
+    {
+        Bootstrap_InitCriticalData();
+        Boostrap_InitBackupData();
+    }
+    critical_epoch::advance();
+#ifdef PERSIST_FLASH
+    SM_RestoreJournal();
+#endif
+    // BKPSRAM holds the newer copy when both tiers are enabled
+#ifdef PERSIST_BKPSRAM
+#ifdef BENCHMARK
+    const uint32_t restore_start = DWT_GetCycles();
+    SM_PersistRestore.restored = SM_RestoreEditState();
+    SM_PersistRestore.restore_cycles = DWT_GetCycles() - restore_start;
+#else
+    SM_RestoreEditState();
+#endif
+#endif
+
+    // Dashes and no flash, the image the framebuffer was just restored to
+    SM_RestoreDisplay();
     
-    BACKUP_SET(SM_Operation, SM_OPT_IS_EDITING);
-    BACKUP_SET(LastStep, SM_OPT_RESETHANDLER);
-    BACKUP_SET(LastResetTick, HAL_GetTick());
-    BACKUP_SET(SM_Inititalized, 1);
+    SM_FlowSignature.reset(SM_StateSignatures[SM_OPT_IS_EDITING]);
+    VOTED_SET(LastResetTick, HAL_GetTick());
+    BACKUP_SET(SM_Control, SM_OPT_IS_EDITING, SM_OPT_IS_EDITING, 1u);
+#ifdef SM_USE_TASKS
+    SM_StartTasks();
+#endif
 }
 
 SM_STATE(SM_OPT_IS_EDITING);
@@ -136,94 +563,400 @@ SM_STATE(SM_OPT_SAVE_AND_EXIT_EDIT);
 SM_STATE(SM_OPT_UPDATE_DISPLAY);
 SM_STATE(SM_OPT_RESETHANDLER);
 
+static SM_Frame SM_BuildFrame(uint32_t context);
+
+constexpr uint32_t SM_Mask(std::initializer_list<uint32_t> states)
+{
+    uint32_t mask = 0;
+    for (const uint32_t state : states)
+        mask |= 1u << state;
+    return mask;
+}
+
+// Every state and the states it may return, besides SM_OPT_RESETHANDLER which any state may
+// go to. A state only runs when the signature register names it, and the edge it takes is
+// folded into the register on exit.
+struct SM_Transition
+{
+    uint32_t state;
+    uint32_t (*run)();
+    bool waits; // sleeps, blocks on the bus or starts a new pass, a chain never runs into it
+    uint32_t successors;
+};
+
+constexpr SM_Transition SM_Transitions[] =
+{
+    { SM_OPT_IS_EDITING, _SM_OPT_IS_EDITING, true, SM_Mask({ SM_OPT_CHECK_TEMPTICK, SM_OPT_READ_KEY_INPUT }) },
+    { SM_OPT_CHECK_TEMPTICK, _SM_OPT_CHECK_TEMPTICK, false, SM_Mask({ SM_OPT_READTEMP, SM_OPT_READ_KEY_INPUT }) },
+    { SM_OPT_READTEMP, _SM_OPT_READTEMP, true, SM_Mask({ SM_OPT_IS_TEMP_IN_RANGE }) },
+    { SM_OPT_IS_TEMP_IN_RANGE, _SM_OPT_IS_TEMP_IN_RANGE, false, SM_Mask({ SM_OPT_TEMP_OUT_OF_RANGE, SM_OPT_READ_KEY_INPUT }) },
+    { SM_OPT_TEMP_OUT_OF_RANGE, _SM_OPT_TEMP_OUT_OF_RANGE, false, SM_Mask({ SM_OPT_READ_KEY_INPUT }) },
+    { SM_OPT_READ_KEY_INPUT, _SM_OPT_READ_KEY_INPUT, false, SM_Mask({ SM_OPT_IS_EDITING, SM_OPT_READ_KEY_DELAY, SM_OPT_ON_KEY_PRESSED }) },
+    { SM_OPT_READ_KEY_DELAY, _SM_OPT_READ_KEY_DELAY, true, SM_Mask({ SM_OPT_IS_EDITING }) },
+    { SM_OPT_ON_KEY_PRESSED, _SM_OPT_ON_KEY_PRESSED, false, SM_Mask({
+        SM_OPT_READ_KEY_DELAY, SM_OPT_UPDATE_KEYNUM, SM_OPT_SWITCH_TARGET_LOW, SM_OPT_SWITCH_TARGET_HIGH,
+        SM_OPT_MOVE_CURSOR_LEFT, SM_OPT_MOVE_CURSOR_RIGHT, SM_OPT_SWITCH_EDIT_MODE, SM_OPT_SAVE_AND_EXIT_EDIT,
+        SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_UPDATE_KEYNUM, _SM_OPT_UPDATE_KEYNUM, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_SWITCH_TARGET_LOW, _SM_OPT_SWITCH_TARGET_LOW, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_SWITCH_TARGET_HIGH, _SM_OPT_SWITCH_TARGET_HIGH, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_MOVE_CURSOR_LEFT, _SM_OPT_MOVE_CURSOR_LEFT, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_MOVE_CURSOR_RIGHT, _SM_OPT_MOVE_CURSOR_RIGHT, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_SWITCH_EDIT_MODE, _SM_OPT_SWITCH_EDIT_MODE, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_SAVE_AND_EXIT_EDIT, _SM_OPT_SAVE_AND_EXIT_EDIT, false, SM_Mask({ SM_OPT_UPDATE_DISPLAY }) },
+    { SM_OPT_UPDATE_DISPLAY, _SM_OPT_UPDATE_DISPLAY, false, SM_Mask({ SM_OPT_IS_EDITING }) },
+    { SM_OPT_RESETHANDLER, _SM_OPT_RESETHANDLER, false, SM_Mask({ SM_OPT_IS_EDITING }) },
+};
+static_assert(std::size(SM_Transitions) == SM_OPT_COUNT);
+
+// The signature register still names the state the reset jump left, so it is set to the resumed one
+static void SM_Resume(uint32_t state)
+{
+    if (state >= SM_OPT_COUNT || state == SM_OPT_RESETHANDLER)
+        state = SM_OPT_IS_EDITING;
+    SM_FlowSignature.reset(SM_StateSignatures[state]);
+    SM_Control.set<SM_CONTROL_OPERATION>(state);
+}
+
+constexpr bool SM_TableInOrder()
+{
+    for (uint32_t i = 0; i < SM_OPT_COUNT; ++i)
+        if (SM_Transitions[i].state != i || (SM_Transitions[i].successors >> SM_OPT_COUNT) != 0)
+            return false;
+    return true;
+}
+
+constexpr bool SM_NoDeadEnds()
+{
+    for (const SM_Transition& transition : SM_Transitions)
+        if ((transition.successors & ~(1u << SM_OPT_RESETHANDLER)) == 0)
+            return false;
+    return true;
+}
+
+// States reached from SM_OPT_IS_EDITING, where SM_Init starts, and from the reset handler
+constexpr uint32_t SM_Reachable()
+{
+    uint32_t reached = SM_Mask({ SM_OPT_IS_EDITING, SM_OPT_RESETHANDLER });
+    for (uint32_t previous = 0; previous != reached;)
+    {
+        previous = reached;
+        for (const SM_Transition& transition : SM_Transitions)
+            if (reached & (1u << transition.state))
+                reached |= transition.successors;
+    }
+    return reached;
+}
+
+static_assert(SM_TableInOrder(), "SM_Transitions must list every state once, in enum order");
+static_assert(SM_NoDeadEnds(), "every state needs a successor other than SM_OPT_RESETHANDLER");
+static_assert(SM_Reachable() == (1u << SM_OPT_COUNT) - 1, "some state is never returned by any reachable state");
+
+// A control flow error resets from the start of a pass, the jump-back left by an earlier
+// state may name one the faulty flow never got to
+static uint32_t SM_FlowError(uint32_t state, uint32_t reason)
+{
+    TRACE_Record(state, reason);
+    BACKUP_FIELD_SET(SM_Control, SM_CONTROL_RESET_JUMP_BACK, SM_OPT_IS_EDITING);
+    return SM_OPT_RESETHANDLER;
+}
+
+// Run one state: the guard compares the signature register with the signature of the state,
+// SM_OPT_RESETHANDLER excepted as it is entered from anywhere. A state returning anything its
+// row does not list is taken as a control flow error, any other edge is one xor on the register.
+// Every state that runs and every rejected one goes into the post-mortem trace. The tasks
+// run their states on registers of their own, the table on SM_FlowSignature.
+static uint32_t SM_Step(uint32_t operation, cfcss_register& signature = SM_FlowSignature)
+{
+    if (operation >= SM_OPT_COUNT || (operation != SM_OPT_RESETHANDLER && !signature.check(SM_StateSignatures[operation])))
+        return SM_FlowError(operation, TRACE_REASON_FLOW_ERROR);
+    TRACE_Record(operation, TRACE_REASON_STEP);
+
+#ifdef BENCHMARK
+    const uint32_t start_cycles = DWT_GetCycles();
+    const uint32_t next = SM_Transitions[operation].run();
+    SM_Profile.record(operation, DWT_GetCycles() - start_cycles);
+#else
+    const uint32_t next = SM_Transitions[operation].run();
+#endif
+    if (next >= SM_OPT_COUNT || !((SM_Transitions[operation].successors | (1u << SM_OPT_RESETHANDLER)) & (1u << next)))
+        return SM_FlowError(next, TRACE_REASON_BAD_SUCCESSOR);
+    signature.update(SM_StateSignatures[operation] ^ SM_StateSignatures[next]);
+    return next;
+}
+
+// SM_Step with the step and key path benchmarks around it
+static uint32_t SM_MeasuredStep(uint32_t operation)
+{
+#ifdef BENCHMARK
+    const uint32_t start_cycles = DWT_GetCycles();
+    const uint32_t start_crc_runs = critical_stats::crc_runs;
+    const uint32_t start_crc_cycles = critical_stats::crc_cycles;
+    const uint32_t start_cache_hits = critical_stats::cache_hits;
+    const uint32_t next = SM_Step(operation);
+    const uint32_t end_cycles = DWT_GetCycles();
+
+    const uint32_t step_cycles = end_cycles - start_cycles;
+    ++SM_Steps.steps;
+    SM_Steps.cycles += step_cycles;
+    if (step_cycles > SM_Steps.max_cycles)
+        SM_Steps.max_cycles = step_cycles;
+
+    if (operation == SM_OPT_READ_KEY_INPUT && next == SM_OPT_ON_KEY_PRESSED)
+    {
+        SM_KeyPathCurrent = {};
+        SM_KeyPathActive = true;
+    }
+    if (SM_KeyPathActive)
+    {
+        ++SM_KeyPathCurrent.passes;
+        SM_KeyPathCurrent.cycles += step_cycles;
+        SM_KeyPathCurrent.crc_runs += critical_stats::crc_runs - start_crc_runs;
+        SM_KeyPathCurrent.crc_cycles += critical_stats::crc_cycles - start_crc_cycles;
+        SM_KeyPathCurrent.cache_hits += critical_stats::cache_hits - start_cache_hits;
+        if (operation == SM_OPT_UPDATE_DISPLAY)
+        {
+            SM_KeyPath = SM_KeyPathCurrent;
+            SM_KeyPathActive = false;
+            SM_RecordKeyLatency(end_cycles);
+        }
+    }
+    return next;
+#else
+    return SM_Step(operation);
+#endif
+}
+
+// Sleeps until the next interrupt unless an event is pending. Interrupts are masked around
+// the check and a pending one still ends WFI, so an event set in between is not lost.
+static bool SM_Sleep()
+{
+    __disable_irq();
+    const bool idle = !SM_Pending();
+    if (idle)
+    {
+#ifdef BENCHMARK
+        const uint32_t start_cycles = DWT_GetCycles();
+#endif
+        __DSB();
+        __WFI();
+#ifdef BENCHMARK
+        SM_IdleRatesSleepCycles += DWT_GetCycles() - start_cycles;
+        ++SM_IdleRatesSleeps;
+#endif
+    }
+    __enable_irq();
+    return idle;
+}
+
+#ifdef SM_SOFT_REJUVENATION
+static bool SM_RejuvenationDue;
+
+// Proactive recovery without a reboot: every protected variable is checked and repaired,
+// the I2C bus is initialized again only when a device stops answering, and the main loop
+// starts over on an empty stack. Clocks, the other peripherals and the display are kept.
+[[noreturn]] static void SM_Rejuvenate()
+{
+    SM_RejuvenationDue = false;
+    TRACE_Record(TRACE_STATE_NONE, TRACE_REASON_REJUVENATION);
+    SCRUB_All();
+    critical_epoch::advance();
+    if (!I2C_IsHealthy())
+    {
+#ifdef BENCHMARK
+        ++SM_Rejuvenations.i2c_recoveries;
+#endif
+        // Writes to the display may have been lost while the bus hung
+        if (I2C_Recover() == HAL_OK)
+            SM_RestoreDisplay();
+    }
+    App_Restart();
+}
+#endif
+
 void SM_Run()
 {
+    critical_epoch::advance();
+#ifdef BENCHMARK
+    if (SM_ServicePending)
+    {
+        BENCH_Boot.service_cycles = DWT_GetCycles() - BENCH_Boot.main_cycles;
+        SM_ServicePending = false;
+    }
+    if (SM_SoftGapPending)
+    {
+        const uint32_t gap_cycles = DWT_GetCycles() - SM_SoftGapStart;
+        ++SM_Rejuvenations.soft_count;
+        SM_Rejuvenations.soft_gap_cycles = gap_cycles;
+        if (gap_cycles > SM_Rejuvenations.max_soft_gap_cycles)
+            SM_Rejuvenations.max_soft_gap_cycles = gap_cycles;
+        SM_SoftGapPending = false;
+    }
+#endif
+
     // Reset after several time automatically
     constexpr uint32_t kGlobalResetTime = 30000;
     uint32_t current_tick = HAL_GetTick();
     uint32_t last_reset_tick;
-    BACKUP_GET(LastResetTick, last_reset_tick);
-    if (!BACKUP_IS_VALID(LastResetTick) || current_tick - last_reset_tick > kGlobalResetTime)
-    {
-        BACKUP_SET(LastResetTick, current_tick);
-        const auto current_opt = SM_Operation.get();
-        BACKUP_SET(SM_ResetJumpBack, current_opt);
-        BACKUP_SET(SM_Operation, SM_OPT_RESETHANDLER);
-    }
-
-    switch (SM_Operation)
-    {
-    SM_CASE(SM_OPT_IS_EDITING);
-    SM_CASE(SM_OPT_CHECK_TEMPTICK);
-    SM_CASE(SM_OPT_READTEMP);
-    SM_CASE(SM_OPT_IS_TEMP_IN_RANGE);
-    SM_CASE(SM_OPT_TEMP_OUT_OF_RANGE);
-    SM_CASE(SM_OPT_READ_KEY_INPUT);
-    SM_CASE(SM_OPT_READ_KEY_DELAY);
-    SM_CASE(SM_OPT_ON_KEY_PRESSED);
-    SM_CASE(SM_OPT_UPDATE_KEYNUM);
-    SM_CASE(SM_OPT_SWITCH_TARGET_LOW);
-    SM_CASE(SM_OPT_SWITCH_TARGET_HIGH);
-    SM_CASE(SM_OPT_MOVE_CURSOR_LEFT);
-    SM_CASE(SM_OPT_MOVE_CURSOR_RIGHT);
-    SM_CASE(SM_OPT_SWITCH_EDIT_MODE);
-    SM_CASE(SM_OPT_SAVE_AND_EXIT_EDIT);
-    SM_CASE(SM_OPT_UPDATE_DISPLAY);
-    default:
-    SM_CASE(SM_OPT_RESETHANDLER);
+    if (!VOTED_GET(LastResetTick, last_reset_tick) || current_tick - last_reset_tick > kGlobalResetTime)
+    {
+        VOTED_SET(LastResetTick, current_tick);
+#ifdef SM_SOFT_REJUVENATION
+        SM_RejuvenationDue = true;
+#else
+        const uint32_t current_opt = SM_Control.get<SM_CONTROL_OPERATION>();
+        BACKUP_SET(SM_Control, SM_OPT_RESETHANDLER, current_opt, SM_Control.get<SM_CONTROL_INITIALIZED>());
+#endif
+    }
+#ifdef SM_SOFT_REJUVENATION
+    // Only between passes, no state is half done and the signature already names IS_EDITING. The
+    // task frames are not on the stack and survive it, but no transfer may be under way.
+    if (SM_RejuvenationDue && SM_Control.get<SM_CONTROL_OPERATION>() == SM_OPT_IS_EDITING
+#ifdef SM_USE_TASKS
+        && !SM_Bus.locked()
+#endif
+    )
+    {
+#ifdef BENCHMARK
+        SM_SoftGapStart = DWT_GetCycles();
+        SM_SoftGapPending = true;
+#endif
+        SM_Rejuvenate();
+    }
+#endif
+
+    uint32_t states = 0;
+#ifdef SM_USE_TASKS
+    // The tasks do the work, the state machine is left with the reset jump. It waits for the
+    // bus, a transfer cut off by the jump would leave a device halfway through it.
+    if (SM_Control.get<SM_CONTROL_OPERATION>() == SM_OPT_RESETHANDLER && !SM_Bus.locked())
+        SM_MeasuredStep(SM_OPT_RESETHANDLER);
+    if (!TASKS_Run())
+        SM_Sleep();
+#else
+    constexpr uint32_t kBudgetCycles = SM_RUN_BUDGET_CYCLES;
+    // A pass only starts when an event asks for one, the main loop wakes on every interrupt
+    // and still feeds the watchdog at least once per SysTick
+    if (SM_Control.get<SM_CONTROL_OPERATION>() != SM_OPT_IS_EDITING || !SM_Sleep())
+    {
+        if constexpr (kBudgetCycles == 0)
+        {
+            SM_Control.set<SM_CONTROL_OPERATION>(SM_MeasuredStep(SM_Control.get<SM_CONTROL_OPERATION>()));
+            states = 1;
+        }
+        else
+        {
+            // Run to completion: chain states until the next one waits or the budget is spent
+            const uint32_t start_cycles = DWT_GetCycles();
+            uint32_t operation = SM_Control.get<SM_CONTROL_OPERATION>();
+            do
+            {
+                operation = SM_MeasuredStep(operation);
+                SM_Control.set<SM_CONTROL_OPERATION>(operation);
+                ++states;
+            } while (operation < SM_OPT_COUNT && !SM_Transitions[operation].waits
+                && DWT_GetCycles() - start_cycles < kBudgetCycles);
+        }
+    }
+#endif
+
+#ifdef BENCHMARK
+    if (states != 0)
+    {
+        ++SM_Runs.calls;
+        SM_Runs.states += states;
+        SM_Runs.last_states = states;
+        if (states > SM_Runs.max_states)
+            SM_Runs.max_states = states;
+    }
+
+    if (current_tick - SM_IdleRatesTick >= 1000)
+    {
+        const uint32_t now_cycles = DWT_GetCycles();
+        const uint32_t active_cycles = now_cycles - SM_IdleRatesCycles - SM_IdleRatesSleepCycles;
+        const uint64_t window_cycles = static_cast<uint64_t>(SystemCoreClock / 1000) * (current_tick - SM_IdleRatesTick);
+        const uint64_t active_permille = static_cast<uint64_t>(active_cycles) * 1000 / window_cycles;
+        SM_IdleRates.idle_permille = active_permille < 1000 ? 1000 - static_cast<uint32_t>(active_permille) : 0;
+        SM_IdleRates.sleeps_per_second = SM_IdleRatesSleeps;
+        SM_IdleRates.writes_per_second = critical_stats::writes - SM_IdleRatesWrites;
+        SM_IdleRates.crc_runs_per_second = critical_stats::crc_runs - SM_IdleRatesCrcRuns;
+        SM_IdleRatesTick = current_tick;
+        SM_IdleRatesWrites = critical_stats::writes;
+        SM_IdleRatesCrcRuns = critical_stats::crc_runs;
+        SM_IdleRatesCycles = now_cycles;
+        SM_IdleRatesSleepCycles = 0;
+        SM_IdleRatesSleeps = 0;
     }
+#else
+    (void)states;
+#endif
 }
 
-SM_STATE(SM_OPT_IS_EDITING)
+void SM_Tick()
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
+    const uint32_t tick = HAL_GetTick();
+    uint32_t events = 0;
+    if (tick % SM_HOUSEKEEPING_PERIOD == 0)
+        events |= SM_EVENT_HOUSEKEEPING;
+    if (static_cast<int32_t>(tick - SM_TemperatureDue) >= 0)
     {
-    case SM_OPT_READ_KEY_INPUT:
-    case SM_OPT_READ_KEY_DELAY:
-    case SM_OPT_UPDATE_DISPLAY:
-    case SM_OPT_RESETHANDLER:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
+        // Rearmed here too, a pass that skips CHECK_TEMPTICK would see it every tick otherwise
+        SM_TemperatureDue = tick + SM_TEMPERATURE_DELAY;
+        events |= SM_EVENT_TEMP_TICK;
     }
-    BACKUP_SET(LastStep, SM_OPT_IS_EDITING);
+    if (events != 0)
+        SM_Signal(events);
+}
 
-    if (!BACKUP_IS_VALID(IsEditing))
-        BACKUP_SET(IsEditing, 0);
+#ifdef BENCHMARK
+// Every state that ran, then one line per filled histogram bucket, in cycles at 168MHz
+void SM_ProfileDump()
+{
+    CONSOLE_Printf("%-20s %10s %10s %10s %10s\r\n", "state", "runs", "min", "mean", "max");
+    for (uint32_t state = 0; state < SM_OPT_COUNT; ++state)
+    {
+        const auto& path = SM_Profile[state];
+        if (path.count == 0)
+            continue;
+        CONSOLE_Printf("%-20s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\r\n", SM_StateNames[state],
+            path.count, path.min_cycles, path.mean_cycles(), path.max_cycles);
+        for (uint32_t bucket = 0; bucket < SM_Profile.buckets; ++bucket)
+            if (path.histogram[bucket] != 0)
+                CONSOLE_Printf("  < 2^%-2" PRIu32 " %10" PRIu32 "\r\n", bucket + 1, path.histogram[bucket]);
+    }
+}
+#endif
 
-    uint32_t is_editing;
-    BACKUP_GET(IsEditing, is_editing);
-    if (is_editing == 0)
+SM_STATE(SM_OPT_IS_EDITING)
+{
+    if (!BACKUP_IS_VALID(EditState))
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
+
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    if (SM_EditContext::get<SM_EDIT_IS_EDITING>(context) == 0)
         return SM_OPT_CHECK_TEMPTICK;
 
+    // No reading while editing
+    SM_Take(SM_EVENT_TEMP_TICK);
     return SM_OPT_READ_KEY_INPUT;
 }
 
 SM_STATE(SM_OPT_CHECK_TEMPTICK)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_IS_EDITING:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_CHECK_TEMPTICK);
-
-    constexpr uint32_t kTemperatureDelay = 5000;
+    SM_Take(SM_EVENT_TEMP_TICK);
     uint32_t current_tick = HAL_GetTick();
     uint32_t temperature_tick;
     BACKUP_GET(TemperatureHandleTick, temperature_tick);
-    if (!BACKUP_IS_VALID(TemperatureHandleTick) || current_tick - temperature_tick > kTemperatureDelay)
+    if (!BACKUP_IS_VALID(TemperatureHandleTick) || current_tick - temperature_tick > SM_TEMPERATURE_DELAY)
     {
         BACKUP_SET(TemperatureHandleTick, current_tick);
+        SM_TemperatureDue = current_tick + SM_TEMPERATURE_DELAY + 1;
         return SM_OPT_READTEMP;
     }
-    
+
+    // Woken early, wait for the tick the reading is really due
+    SM_TemperatureDue = temperature_tick + SM_TEMPERATURE_DELAY + 1;
     return SM_OPT_READ_KEY_INPUT;
 }
 
@@ -271,121 +1004,82 @@ static lm75a_temp_t READTEMPIMPLS()
     }
 }
 
-SM_STATE(SM_OPT_READTEMP)
+static void SM_StoreTemperature(lm75a_temp_t temp)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_CHECK_TEMPTICK:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_READTEMP);
+    BACKUP_SET(TemperatureCurrent, static_cast<uint32_t>(temp) * 1000);
+}
 
+SM_STATE(SM_OPT_READTEMP)
+{
     LM75A_SetMode(LM75A_ADDR_CONF, LM75A_MODE_WORKING);   
     const auto temp = READTEMPIMPLS();
     LM75A_SetMode(LM75A_ADDR_CONF, LM75A_MODE_SHUTDOWN);
     if (temp != LM75A_RESULT_ERROR)
     {
-        BACKUP_SET(TemperatureCurrent, static_cast<uint32_t>(temp) * 1000);
+        SM_StoreTemperature(temp);
         return SM_OPT_IS_TEMP_IN_RANGE;
     }
     
     // Deadlock might happen here, so we try to 
     // recover the state by calling RESET_HANDLER
-    BACKUP_SET(SM_ResetJumpBack, SM_OPT_READTEMP);
+    BACKUP_FIELD_SET(SM_Control, SM_CONTROL_RESET_JUMP_BACK, SM_OPT_READTEMP);
     return SM_OPT_RESETHANDLER;
 }
 
 SM_STATE(SM_OPT_IS_TEMP_IN_RANGE)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
+    if (!BACKUP_IS_VALID(EditState))
     {
-    case SM_OPT_READTEMP:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_IS_TEMP_IN_RANGE);
-
-    if (!BACKUP_IS_VALID(TemperatureLow))
-    {
-        BACKUP_SET(TemperatureLow, SM_TEMPERATURE_LOW_INIT);
-        return SM_OPT_READ_KEY_INPUT;
-    }
-    if (!BACKUP_IS_VALID(TemperatureHigh))
-    {
-        BACKUP_SET(TemperatureHigh, SM_TEMPERATURE_HIGH_INIT);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_READ_KEY_INPUT;
     }
+
+    uint32_t temperature_low;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_LOW, temperature_low);
+    const uint32_t temperature_high = EditState.get<SM_EDIT_STATE_HIGH>();
+
     if (!BACKUP_IS_VALID(TemperatureCurrent))
     {
-        BACKUP_SET(TemperatureCurrent, (TemperatureLow + TemperatureHigh) / 2);
+        BACKUP_SET(TemperatureCurrent, (temperature_low + temperature_high) / 2);
         return SM_OPT_READ_KEY_INPUT;
     }
 
-    uint32_t temperature_low;
-    BACKUP_GET(TemperatureLow, temperature_low);
-    uint32_t temperature_high;
-    BACKUP_GET(TemperatureHigh, temperature_high);
     uint32_t temperature_current;
     BACKUP_GET(TemperatureCurrent, temperature_current);
 
     if (temperature_current < temperature_low || temperature_current > temperature_high)
+    {
+        SM_Signal(SM_EVENT_ALARM);
         return SM_OPT_TEMP_OUT_OF_RANGE;
+    }
 
+    SM_Take(SM_EVENT_ALARM);
     return SM_OPT_READ_KEY_INPUT;
 }
 
 SM_STATE(SM_OPT_TEMP_OUT_OF_RANGE)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_IS_TEMP_IN_RANGE:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_TEMP_OUT_OF_RANGE);
-
-    constexpr uint32_t kBeepDuration = 1000;
-    constexpr uint32_t kBeepFrequency = 2;
-    for (uint32_t i = 0; i < kBeepDuration; i += 2 * kBeepFrequency)
-    {
-        BEEP_SwitchMode(BEEP_MODE_ON);
-        HAL_Delay(kBeepFrequency);
-        BEEP_SwitchMode(BEEP_MODE_OFF);
-        HAL_Delay(kBeepFrequency);
-    }
+    // Returns at once, TIM6 plays the tone while the passes go on
+    BEEP_Play(BEEP_PATTERN_CONTINUOUS, SM_BEEP_DURATION);
+    SM_Take(SM_EVENT_ALARM);
     return SM_OPT_READ_KEY_INPUT;
 }
 
 SM_STATE(SM_OPT_READ_KEY_INPUT)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_IS_EDITING:
-    case SM_OPT_CHECK_TEMPTICK:
-    case SM_OPT_IS_TEMP_IN_RANGE:
-    case SM_OPT_TEMP_OUT_OF_RANGE:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_READ_KEY_INPUT);
-
+    // Taken before KeyPressed is read, a key pressed after that asks for another pass
+    SM_Take(SM_EVENT_KEY);
+    SM_LatchKey();
     uint32_t key_pressed;
     BACKUP_GET(KeyPressed, key_pressed);
     if (!BACKUP_IS_VALID(KeyPressed) || key_pressed == 0)
+    {
+        // Nothing to do in this pass, spend the idle slot on the scrubber and the console
+        SM_Take(SM_EVENT_HOUSEKEEPING);
+        SCRUB_Step();
+        CONSOLE_Poll();
         return SM_OPT_IS_EDITING;
+    }
     
     BACKUP_SET(KeyPressed, 0);
     uint8_t buffer[3];
@@ -411,37 +1105,12 @@ SM_STATE(SM_OPT_READ_KEY_INPUT)
 
 SM_STATE(SM_OPT_READ_KEY_DELAY)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_READ_KEY_INPUT:
-    case SM_OPT_ON_KEY_PRESSED:
-    case SM_OPT_SAVE_AND_EXIT_EDIT:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_READ_KEY_DELAY);
-
-    constexpr uint32_t kEditingDelay = 20;
-    HAL_Delay(kEditingDelay);
+    HAL_Delay(SM_KEY_RETRY_DELAY);
     return SM_OPT_IS_EDITING;
 }
 
 SM_STATE(SM_OPT_ON_KEY_PRESSED)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_READ_KEY_INPUT:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_ON_KEY_PRESSED);
-
     uint32_t key_data;
     BACKUP_GET(KeyData, key_data);
     if (!BACKUP_IS_VALID(KeyData))
@@ -454,12 +1123,13 @@ SM_STATE(SM_OPT_ON_KEY_PRESSED)
     if (key == 0)
         return SM_OPT_READ_KEY_DELAY;
     
-    if (!BACKUP_IS_VALID(IsEditing))
+    if (!BACKUP_IS_VALID(EditState))
     {
-        BACKUP_SET(IsEditing, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_READ_KEY_DELAY;
     }
 
+    SM_Signal(SM_EVENT_DISPLAY);
     switch (key)
     {
     case ZLG7290_KEY_0: BACKUP_SET(KeyNum, 0); return SM_OPT_UPDATE_KEYNUM;
@@ -484,54 +1154,23 @@ SM_STATE(SM_OPT_ON_KEY_PRESSED)
 
 SM_STATE(SM_OPT_UPDATE_KEYNUM)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_UPDATE_KEYNUM);
-
     if (!BACKUP_IS_VALID(KeyNum))
         return SM_OPT_UPDATE_DISPLAY;
     uint32_t keynum;
     BACKUP_GET(KeyNum, keynum);
 
-    if (!BACKUP_IS_VALID(IsEditing))
+    if (!BACKUP_IS_VALID(EditState))
     {
-        BACKUP_SET(IsEditing, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_UPDATE_DISPLAY;
     }
 
-    if (!BACKUP_IS_VALID(EditTarget))
-    {
-        BACKUP_SET(EditTarget, 0);
-        BACKUP_SET(CursorPos, 0);
-        BACKUP_SET(IsEditing, 0);
-        return SM_OPT_UPDATE_DISPLAY;
-    }
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    uint32_t new_value = SM_EditContext::get<SM_EDIT_TEMPERATE>(context);
+    const uint32_t cursor_pos = SM_EditContext::get<SM_EDIT_CURSOR_POS>(context);
 
-    if (!BACKUP_IS_VALID(EditTemperate))
-    {
-        BACKUP_SET(EditTemperate, 0);
-        BACKUP_SET(CursorPos, 0);
-        BACKUP_SET(IsEditing, 0);
-        return SM_OPT_UPDATE_DISPLAY;
-    }
-    uint32_t new_value;
-    BACKUP_GET(EditTemperate, new_value);
-
-    if (!BACKUP_IS_VALID(CursorPos))
-    {
-        BACKUP_SET(CursorPos, 0);
-        BACKUP_SET(IsEditing, 0);
-        return SM_OPT_UPDATE_DISPLAY;
-    }
-
-    switch (CursorPos)
+    switch (cursor_pos)
     {
     case 0: new_value = new_value % 100000 + keynum * 100000; break;
     case 1: new_value = new_value % 10000 + keynum * 10000 + new_value / 100000 * 100000; break;
@@ -542,255 +1181,131 @@ SM_STATE(SM_OPT_UPDATE_KEYNUM)
     default: __builtin_unreachable();
     }
     
-    BACKUP_SET(EditTemperate, new_value);
+    BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::with<SM_EDIT_TEMPERATE>(context, new_value));
 
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_SWITCH_TARGET_LOW)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_SWITCH_TARGET_LOW);
-
-    BACKUP_SET(IsEditing, 1);
-    BACKUP_SET(EditTarget, 0);
-    BACKUP_SET(CursorPos, 0);
-
-    if (!BACKUP_IS_VALID(TemperatureLow))
-        BACKUP_SET(TemperatureLow, SM_TEMPERATURE_LOW_INIT);
+    if (!BACKUP_IS_VALID(EditState))
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
 
     uint32_t temperate_low;
-    BACKUP_GET(TemperatureLow, temperate_low);
-    BACKUP_SET(EditTemperate, temperate_low / 8 % 1000000);
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_LOW, temperate_low);
+    // Editing, cursor at 0, low temperature target
+    BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::pack(1u, 0u, 0u, temperate_low / 8 % 1000000));
     
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_SWITCH_TARGET_HIGH)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_SWITCH_TARGET_HIGH);
-
-    BACKUP_SET(IsEditing, 1);
-    BACKUP_SET(EditTarget, 1);
-    BACKUP_SET(CursorPos, 0);
-
-    if (!BACKUP_IS_VALID(TemperatureHigh))
-        BACKUP_SET(TemperatureHigh, SM_TEMPERATURE_HIGH_INIT);
+    if (!BACKUP_IS_VALID(EditState))
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
     
     uint32_t temperate_high;
-    BACKUP_GET(TemperatureHigh, temperate_high);
-    BACKUP_SET(EditTemperate, temperate_high / 8 % 1000000);
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_HIGH, temperate_high);
+    // Editing, cursor at 0, high temperature target
+    BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::pack(1u, 0u, 1u, temperate_high / 8 % 1000000));
 
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_MOVE_CURSOR_LEFT)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_MOVE_CURSOR_LEFT);
-
-    if (!BACKUP_IS_VALID(IsEditing))
+    if (!BACKUP_IS_VALID(EditState))
     {
-        BACKUP_SET(IsEditing, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_UPDATE_DISPLAY;
     }
 
-    if (!BACKUP_IS_VALID(CursorPos))
-        BACKUP_SET(CursorPos, 0);
-
-    uint32_t cur_pos;
-    BACKUP_GET(CursorPos, cur_pos);
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    const uint32_t cur_pos = SM_EditContext::get<SM_EDIT_CURSOR_POS>(context);
     if (cur_pos > 0)
-        BACKUP_SET(CursorPos, cur_pos - 1);
+        BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::with<SM_EDIT_CURSOR_POS>(context, cur_pos - 1));
 
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_MOVE_CURSOR_RIGHT)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
+    if (!BACKUP_IS_VALID(EditState))
     {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_MOVE_CURSOR_RIGHT);
-
-    if (!BACKUP_IS_VALID(IsEditing))
-    {
-        BACKUP_SET(IsEditing, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_UPDATE_DISPLAY;
     }
 
-    if (!BACKUP_IS_VALID(CursorPos))
-        BACKUP_SET(CursorPos, 0);
-
-    uint32_t cur_pos;
-    BACKUP_GET(CursorPos, cur_pos);
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    const uint32_t cur_pos = SM_EditContext::get<SM_EDIT_CURSOR_POS>(context);
     if (cur_pos < 5)
-        BACKUP_SET(CursorPos, cur_pos + 1);
+        BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::with<SM_EDIT_CURSOR_POS>(context, cur_pos + 1));
 
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_SWITCH_EDIT_MODE)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
+    if (!BACKUP_IS_VALID(EditState))
     {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_SWITCH_EDIT_MODE);
-
-    if (!BACKUP_IS_VALID(IsEditing))
-    {
-        BACKUP_SET(IsEditing, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_UPDATE_DISPLAY;
     }
-    uint32_t is_editing;
-    BACKUP_GET(IsEditing, is_editing);
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
 
-    if (is_editing)
+    if (SM_EditContext::get<SM_EDIT_IS_EDITING>(context))
     {
-        BACKUP_SET(IsEditing, 0);
-        BACKUP_SET(CursorPos, 0);
-        BACKUP_SET(EditTarget, 0);
+        const uint32_t edit_temperate = SM_EditContext::get<SM_EDIT_TEMPERATE>(context);
+        BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::pack(0u, 0u, 0u, edit_temperate));
     }
     else
     {
-        BACKUP_SET(IsEditing, 1);
-        BACKUP_SET(CursorPos, 0);
-        BACKUP_SET(EditTarget, 0);
-        if (!BACKUP_IS_VALID(TemperatureLow))
-            BACKUP_SET(TemperatureLow, SM_TEMPERATURE_LOW_INIT);
-        uint32_t temperature_low;
-        BACKUP_GET(TemperatureLow, temperature_low);
-        BACKUP_SET(EditTemperate, temperature_low / 8 % 1000000);
+        const uint32_t temperature_low = EditState.get<SM_EDIT_STATE_LOW>();
+        BACKUP_FIELD_SET(EditState, SM_EDIT_STATE_CONTEXT, SM_EditContext::pack(1u, 0u, 0u, temperature_low / 8 % 1000000));
     }
     return SM_OPT_UPDATE_DISPLAY;
 }
 
 SM_STATE(SM_OPT_SAVE_AND_EXIT_EDIT)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_SAVE_AND_EXIT_EDIT);
-
-    if (!BACKUP_IS_VALID(IsEditing))
-    {
-        BACKUP_SET(IsEditing, 0);
-        return SM_OPT_UPDATE_DISPLAY;
-    }
-
-    if (!BACKUP_IS_VALID(IsEditing))
-        return SM_OPT_READ_KEY_DELAY;
-
-    BACKUP_SET(IsEditing, 0);
-    BACKUP_SET(CursorPos, 0);
-    if (!BACKUP_IS_VALID(EditTarget))
+    if (!BACKUP_IS_VALID(EditState))
     {
-        BACKUP_SET(EditTarget, 0);
-        return SM_OPT_UPDATE_DISPLAY;
-    }
-    if (!BACKUP_IS_VALID(EditTemperate))
-    {
-        BACKUP_SET(EditTemperate, 0);
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
         return SM_OPT_UPDATE_DISPLAY;
     }
 
-    uint32_t current_temp;
-    BACKUP_GET(EditTemperate, current_temp);
-    current_temp *= 8;
-    uint32_t edit_target;
-    BACKUP_GET(EditTarget, edit_target);
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    const uint32_t edit_temperate = SM_EditContext::get<SM_EDIT_TEMPERATE>(context);
+    const uint32_t edit_target = SM_EditContext::get<SM_EDIT_TARGET>(context);
+    uint32_t temperate_low = EditState.get<SM_EDIT_STATE_LOW>();
+    uint32_t temperate_high = EditState.get<SM_EDIT_STATE_HIGH>();
+    const uint32_t current_temp = edit_temperate * 8;
 
     if (edit_target == 0)
-    {
-        uint32_t temperate_high;
-        BACKUP_GET(TemperatureHigh, temperate_high);
-        if (current_temp > temperate_high)
-            current_temp = temperate_high;
-        BACKUP_SET(TemperatureLow, current_temp);
-    }
+        temperate_low = current_temp > temperate_high ? temperate_high : current_temp;
     else
-    {
-        uint32_t temperate_low;
-        BACKUP_GET(TemperatureLow, temperate_low);
-        if (current_temp < temperate_low)
-            current_temp = temperate_low;
-        BACKUP_SET(TemperatureHigh, current_temp);
-    }
+        temperate_high = current_temp < temperate_low ? temperate_low : current_temp;
+
+    // Leave the edit mode and save the threshold in a single commit
+    BACKUP_SET(EditState, SM_EditContext::pack(0u, 0u, edit_target, edit_temperate), temperate_low, temperate_high);
+#ifdef PERSIST_BKPSRAM
+    SM_PersistEditState();
+#endif
+#ifdef PERSIST_FLASH
+    SM_JournalThresholds();
+#endif
     return SM_OPT_UPDATE_DISPLAY;
 }
 
-SM_STATE(SM_OPT_UPDATE_DISPLAY)
+// The edited value with the cursor flashing, or dashes outside the edit mode
+static SM_Frame SM_BuildFrame(uint32_t context)
 {
-    uint32_t last_step;
-    BACKUP_GET(LastStep, last_step);
-    switch (last_step)
-    {
-    case SM_OPT_ON_KEY_PRESSED:
-    case SM_OPT_UPDATE_KEYNUM:
-    case SM_OPT_SWITCH_TARGET_LOW:
-    case SM_OPT_SWITCH_TARGET_HIGH:
-    case SM_OPT_MOVE_CURSOR_LEFT:
-    case SM_OPT_MOVE_CURSOR_RIGHT:
-    case SM_OPT_SWITCH_EDIT_MODE:
-    case SM_OPT_SAVE_AND_EXIT_EDIT:
-        break;
-    default:
-        return SM_OPT_RESETHANDLER;
-    }
-    BACKUP_SET(LastStep, SM_OPT_UPDATE_DISPLAY);
-
-    if (!BACKUP_IS_VALID(IsEditing))
-    {
-        BACKUP_SET(IsEditing, 0);
-        return SM_OPT_IS_EDITING;
-    }
-
-    uint32_t is_editing;
-    BACKUP_GET(IsEditing, is_editing);
-    if (is_editing)
+    SM_Frame frame;
+    if (SM_EditContext::get<SM_EDIT_IS_EDITING>(context))
     {
         constexpr uint8_t display_table[10] 
         {
@@ -798,67 +1313,238 @@ SM_STATE(SM_OPT_UPDATE_DISPLAY)
             ZLG7290_DISPLAY_NUM4, ZLG7290_DISPLAY_NUM5, ZLG7290_DISPLAY_NUM6, ZLG7290_DISPLAY_NUM7,
             ZLG7290_DISPLAY_NUM8, ZLG7290_DISPLAY_NUM9
         };
-        if (!BACKUP_IS_VALID(EditTemperate))
-            BACKUP_SET(EditTemperate, 0);
-        if (!BACKUP_IS_VALID(CursorPos))
-            BACKUP_SET(CursorPos, 0);
-        uint32_t temp;
-        BACKUP_GET(EditTemperate, temp);
-        uint32_t cursor;
-        BACKUP_GET(CursorPos, cursor);
-
-        uint8_t display[8];
-        display[0] = display[7] = 0;
-        display[1] = display_table[temp / 100000 % 10];
-        display[2] = display_table[temp / 10000 % 10];
-        display[3] = display_table[temp / 1000 % 10] | ZLG7290_DISPLAY_DOT;
-        display[4] = display_table[temp / 100 % 10];
-        display[5] = display_table[temp / 10 % 10];
-        display[6] = display_table[temp % 10];
-        ZLG7290_Write(&hi2c1, ZLG7290_ADDR_DPRAM0, display, sizeof(display));
-
-        // Start flash
-        uint8_t cmd[2];
-        cmd[0] = 0b01110000;
-        cmd[1] = 1 << (cursor + 1);
-        ZLG7290_Write(&hi2c1, ZLG7290_ADDR_CMDBUF0, cmd, sizeof(cmd));
-        
-        BACKUP_SET(IsEditing, 1);
+        const uint32_t temp = SM_EditContext::get<SM_EDIT_TEMPERATE>(context);
+        const uint32_t cursor = SM_EditContext::get<SM_EDIT_CURSOR_POS>(context);
+
+        frame.digits[0] = frame.digits[7] = 0;
+        frame.digits[1] = display_table[temp / 100000 % 10];
+        frame.digits[2] = display_table[temp / 10000 % 10];
+        frame.digits[3] = display_table[temp / 1000 % 10] | ZLG7290_DISPLAY_DOT;
+        frame.digits[4] = display_table[temp / 100 % 10];
+        frame.digits[5] = display_table[temp / 10 % 10];
+        frame.digits[6] = display_table[temp % 10];
+        // Flash the digit under the cursor
+        frame.flash = 1 << (cursor + 1);
     }
     else
     {
-        uint8_t display[8] 
-        { 
-            ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-            ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-            ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE,
-            ZLG7290_DISPLAY_MIDDLE, ZLG7290_DISPLAY_MIDDLE
-        };
-        ZLG7290_Write(&hi2c1, ZLG7290_ADDR_DPRAM0, display, sizeof(display));
-        
-        // Stop flash
-        uint8_t cmd[2];
-        cmd[0] = 0b01110000;
-        cmd[1] = 0b00000000;
-        ZLG7290_Write(&hi2c1, ZLG7290_ADDR_CMDBUF0, cmd, sizeof(cmd));
+        memset(frame.digits, ZLG7290_DISPLAY_MIDDLE, sizeof(frame.digits));
+        frame.flash = 0;
     }
+    return frame;
+}
 
+SM_STATE(SM_OPT_UPDATE_DISPLAY)
+{
+    SM_Take(SM_EVENT_DISPLAY);
+    if (!BACKUP_IS_VALID(EditState))
+    {
+        BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
+        return SM_OPT_IS_EDITING;
+    }
+
+    uint32_t context;
+    BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+    SM_ShowFrame(SM_BuildFrame(context));
     return SM_OPT_IS_EDITING;
 }
 
 extern "C" void Reset_Handler();
 SM_STATE(SM_OPT_RESETHANDLER)
 {
-    BACKUP_SET(LastStep, SM_OPT_RESETHANDLER);
+    Bootstrap_SealSections();
+    App_Quiesce();
     Reset_Handler();
     __builtin_unreachable();
     return SM_OPT_IS_EDITING;
 }
 
+#ifdef SM_USE_TASKS
+// The application as cooperative tasks. Each task owns one event and runs the same states
+// as the table, so a slow display write no longer holds a key press behind it.
+// The protected variables stay as they are, and every wait of a task is a checked record.
+
+// Control flow signature of the keypad and sensor tasks. Each starts its pass at a fixed state
+// and runs the states after it through SM_Step, as the table does on SM_FlowSignature.
+__attribute__((section(BACKUP_SECTION_PRIMARY))) constinit cfcss_register SM_KeypadSignature{critical_image, SM_StateSignatures[SM_OPT_ON_KEY_PRESSED]};
+__attribute__((section(BACKUP_SECTION_PRIMARY))) constinit cfcss_register SM_SensorSignature{critical_image, SM_StateSignatures[SM_OPT_IS_EDITING]};
+
+// A flow error or a failed state hands the reset jump to SM_Run, which takes it once the bus is free
+static uint32_t SM_TaskStep(uint32_t operation, cfcss_register& signature)
+{
+    const uint32_t next = SM_Step(operation, signature);
+    if (next == SM_OPT_RESETHANDLER)
+        SM_Control.set<SM_CONTROL_OPERATION>(SM_OPT_RESETHANDLER);
+    return next;
+}
+
+#ifdef BENCHMARK
+// A key was taken, the display task records the latency once it has shown it
+static bool SM_KeyLatencyPending;
+#endif
+
+static task SM_KeypadTask()
+{
+    for (;;)
+    {
+        co_await TASKS_Wait(SM_EVENT_KEY);
+        SM_LatchKey();
+        uint32_t key_pressed;
+        BACKUP_GET(KeyPressed, key_pressed);
+        if (!BACKUP_IS_VALID(KeyPressed) || key_pressed == 0)
+            continue;
+        BACKUP_SET(KeyPressed, 0);
+
+        // Same key in two reads in a row, as READ_KEY_INPUT does
+        co_await SM_Bus.lock();
+        uint8_t buffer[3];
+        uint8_t again[3];
+        bool read = co_await task_i2c::read(ZLG7290_SLVAEADDR, ZLG7290_ADDR_KEY, buffer, sizeof(buffer)) == HAL_OK;
+        bool stable = false;
+        for (uint32_t i = 1; read && !stable && i < 3; ++i)
+        {
+            read = co_await task_i2c::read(ZLG7290_SLVAEADDR, ZLG7290_ADDR_KEY, again, sizeof(again)) == HAL_OK;
+            stable = read && memcmp(buffer, again, sizeof(buffer)) == 0;
+        }
+        SM_Bus.unlock();
+        if (!stable)
+        {
+            co_await TASKS_Delay(SM_KEY_RETRY_DELAY);
+            continue;
+        }
+
+        // The reads above are READ_KEY_INPUT, the chain of the task starts after it
+        BACKUP_SET(KeyData, buffer[0] | (buffer[1] << 8) | (buffer[2] << 16));
+        SM_KeypadSignature.reset(SM_StateSignatures[SM_OPT_ON_KEY_PRESSED]);
+        const uint32_t next = SM_TaskStep(SM_OPT_ON_KEY_PRESSED, SM_KeypadSignature);
+        if (next == SM_OPT_READ_KEY_DELAY)
+        {
+            co_await TASKS_Delay(SM_KEY_RETRY_DELAY);
+            continue;
+        }
+#ifdef BENCHMARK
+        SM_KeyLatencyPending = true;
+#endif
+        // Every edit state ends in UPDATE_DISPLAY, which is the display task
+        if (next != SM_OPT_UPDATE_DISPLAY && next != SM_OPT_RESETHANDLER)
+            SM_TaskStep(next, SM_KeypadSignature);
+    }
+}
+
+// READTEMP reads through the diverse READTEMPIMPLS with the blocking driver, so it runs with
+// the bus held and the other tasks wait the few milliseconds of one reading every 5 seconds
+static task SM_SensorTask()
+{
+    for (;;)
+    {
+        co_await TASKS_Wait(SM_EVENT_TEMP_TICK);
+        SM_SensorSignature.reset(SM_StateSignatures[SM_OPT_IS_EDITING]);
+        if (SM_TaskStep(SM_OPT_IS_EDITING, SM_SensorSignature) != SM_OPT_CHECK_TEMPTICK
+            || SM_TaskStep(SM_OPT_CHECK_TEMPTICK, SM_SensorSignature) != SM_OPT_READTEMP)
+            continue;
+
+        co_await SM_Bus.lock();
+        const uint32_t next = SM_TaskStep(SM_OPT_READTEMP, SM_SensorSignature);
+        SM_Bus.unlock();
+        // Out of range wakes the alarm task, its state is left to it
+        if (next == SM_OPT_IS_TEMP_IN_RANGE)
+            SM_TaskStep(SM_OPT_IS_TEMP_IN_RANGE, SM_SensorSignature);
+    }
+}
+
+static task SM_DisplayTask()
+{
+    for (;;)
+    {
+        co_await TASKS_Wait(SM_EVENT_DISPLAY);
+        if (!BACKUP_IS_VALID(EditState))
+            BACKUP_SET(EditState, SM_EDIT_STATE_INIT);
+        uint32_t context;
+        BACKUP_FIELD_GET(EditState, SM_EDIT_STATE_CONTEXT, context);
+        SM_Frame frame = SM_BuildFrame(context);
+        uint32_t first, last;
+        bool flash;
+        SM_FrameChanges(frame, first, last, flash);
+
+        // The changed digits last to first and then the flash command, the order ZLG7290_Write
+        // uses. The bus is held for one byte at a time and the other tasks run in the gaps.
+        struct
+        {
+            uint16_t reg;
+            uint8_t value;
+        } writes[sizeof(frame.digits) + 2];
+        uint32_t count = 0;
+        for (uint32_t i = last; i > first; --i)
+            writes[count++] = { static_cast<uint16_t>(ZLG7290_ADDR_DPRAM0 + i - 1), frame.digits[i - 1] };
+        if (flash)
+        {
+            writes[count++] = { ZLG7290_ADDR_CMDBUF1, frame.flash };
+            writes[count++] = { ZLG7290_ADDR_CMDBUF0, 0b01110000 };
+        }
+        bool written = true;
+        for (uint32_t i = 0; written && i < count; ++i)
+        {
+            co_await SM_Bus.lock();
+            written = co_await task_i2c::write(ZLG7290_SLVAEADDR, writes[i].reg, &writes[i].value, 1) == HAL_OK;
+            SM_Bus.unlock();
+            co_await TASKS_Delay(ZLG7290_WRITE_GAP_MS);
+        }
+        if (!written)
+        {
+            // The cache still has the old frame, draw again a little later
+            co_await TASKS_Delay(SM_KEY_RETRY_DELAY);
+            SM_Signal(SM_EVENT_DISPLAY);
+            continue;
+        }
+        SM_CacheFrame(frame);
+#ifdef BENCHMARK
+        if (SM_KeyLatencyPending)
+        {
+            SM_RecordKeyLatency(DWT_GetCycles());
+            SM_KeyLatencyPending = false;
+        }
+#endif
+    }
+}
+
+static task SM_AlarmTask()
+{
+    for (;;)
+    {
+        co_await TASKS_Wait(SM_EVENT_ALARM);
+        BEEP_Play(BEEP_PATTERN_CONTINUOUS, SM_BEEP_DURATION);
+    }
+}
+
+static task SM_HousekeepingTask()
+{
+    for (;;)
+    {
+        co_await TASKS_Wait(SM_EVENT_HOUSEKEEPING);
+        SCRUB_Step();
+        CONSOLE_Poll();
+    }
+}
+
+// Spawn order is the order every scheduler pass resumes them in, the keypad goes first
+static void SM_StartTasks()
+{
+    if (!TASKS_Spawn(SM_KeypadTask()) || !TASKS_Spawn(SM_DisplayTask()) || !TASKS_Spawn(SM_SensorTask())
+        || !TASKS_Spawn(SM_AlarmTask()) || !TASKS_Spawn(SM_HousekeepingTask()))
+        Error_Handler();
+}
+#endif
+
 extern "C" void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
     if (GPIO_Pin == GPIO_PIN_13)
-        BACKUP_SET(KeyPressed, 1);
+    {
+        SM_KeyInterrupt = true;
+        SM_Signal(SM_EVENT_KEY);
+#ifdef BENCHMARK
+        SM_KeyInterruptCycles = DWT_GetCycles();
+#endif
+    }
 }
 
 extern "C" void HAL_Delay(uint32_t delay)
@@ -0,0 +1,199 @@
+#include "tasks.hpp"
+
+#include "i2c.h"
+#include "trace.h"
+
+TASKS_Statistics TASKS_Stats;
+
+struct task_slot
+{
+    std::coroutine_handle<> handle;
+    task_wait_record wait;
+    task_lock* lock; // taken for the task before it resumes, the wait is ignored meanwhile
+    uint32_t woken;
+};
+
+alignas(8) static uint8_t TASKS_Arena[TASKS_ARENA_SIZE];
+static task_slot TASKS_Slots[TASKS_MAX];
+static uint32_t TASKS_Current;
+static volatile uint32_t TASKS_Pending;
+
+// Completion of the running interrupt driven transfer
+static volatile bool TASKS_I2CDone;
+static volatile HAL_StatusTypeDef TASKS_I2CStatus;
+
+void* task::promise_type::operator new(size_t size) noexcept
+{
+    size = (size + 7) & ~static_cast<size_t>(7);
+    if (size > sizeof(TASKS_Arena) - TASKS_Stats.arena_used)
+        return nullptr;
+    void* frame = TASKS_Arena + TASKS_Stats.arena_used;
+    TASKS_Stats.arena_used += size;
+    return frame;
+}
+
+bool TASKS_Spawn(const task& t) noexcept
+{
+    if (!t.handle() || TASKS_Stats.tasks >= TASKS_MAX)
+        return false;
+    task_slot& slot = TASKS_Slots[TASKS_Stats.tasks++];
+    slot.handle = t.handle();
+    slot.lock = nullptr;
+    slot.woken = 0;
+    // Due right away, the first resume runs the task up to its first co_await
+    slot.wait.set(HAL_GetTick(), 1u, 0u);
+    return true;
+}
+
+void TASKS_Signal(uint32_t events) noexcept
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    TASKS_Pending = TASKS_Pending | events;
+    __set_PRIMASK(primask);
+}
+
+uint32_t TASKS_Take(uint32_t events) noexcept
+{
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    const uint32_t taken = TASKS_Pending & events;
+    TASKS_Pending = TASKS_Pending & ~taken;
+    __set_PRIMASK(primask);
+    return taken;
+}
+
+void TASKS_Suspend(uint32_t deadline, bool timed, uint32_t events) noexcept
+{
+    TASKS_Slots[TASKS_Current].wait.set(deadline, static_cast<uint32_t>(timed), events);
+}
+
+uint32_t TASKS_Woken() noexcept
+{
+    return TASKS_Slots[TASKS_Current].woken;
+}
+
+// Whether the wait of a slot is over, resume takes the lock or the events for the task
+static bool TASKS_Due(task_slot& slot, bool resume) noexcept
+{
+    if (!slot.handle || slot.handle.done())
+        return false;
+    if (slot.lock != nullptr)
+        return resume ? slot.lock->try_lock() : !slot.lock->locked();
+    if (!slot.wait.is_valid())
+    {
+        if (resume)
+        {
+            ++TASKS_Stats.corrupted_waits;
+            slot.woken = 0;
+        }
+        return true;
+    }
+
+    const uint32_t events = slot.wait.get<TASKS_WAIT_EVENTS>();
+    if (TASKS_Pending & events)
+    {
+        if (resume)
+            slot.woken = TASKS_Take(events);
+        return true;
+    }
+    if (slot.wait.get<TASKS_WAIT_TIMED>() && static_cast<int32_t>(HAL_GetTick() - slot.wait.get<TASKS_WAIT_DEADLINE>()) >= 0)
+    {
+        if (resume)
+            slot.woken = 0;
+        return true;
+    }
+    return false;
+}
+
+bool TASKS_Run() noexcept
+{
+    bool resumed = false;
+    for (uint32_t i = 0; i < TASKS_Stats.tasks; ++i)
+    {
+        task_slot& slot = TASKS_Slots[i];
+        if (!TASKS_Due(slot, true))
+            continue;
+        slot.lock = nullptr;
+        TASKS_Current = i;
+        ++TASKS_Stats.resumes;
+        TRACE_Record(i, TRACE_REASON_TASK);
+        slot.handle.resume();
+        resumed = true;
+    }
+    return resumed;
+}
+
+bool TASKS_Ready() noexcept
+{
+    for (uint32_t i = 0; i < TASKS_Stats.tasks; ++i)
+        if (TASKS_Due(TASKS_Slots[i], false))
+            return true;
+    return false;
+}
+
+void task_lock::awaiter::await_suspend(std::coroutine_handle<>) const noexcept
+{
+    TASKS_Slots[TASKS_Current].lock = &lock_;
+}
+
+bool task_i2c::await_ready() noexcept
+{
+    // A completion left over from a transfer that timed out must not end this one
+    TASKS_Take(TASKS_EVENT_I2C);
+    TASKS_I2CDone = false;
+    deadline_ = HAL_GetTick() + TASKS_I2C_TIMEOUT_MS;
+    status_ = write_
+        ? HAL_I2C_Mem_Write_IT(&hi2c1, device_, reg_, I2C_MEMADD_SIZE_8BIT, data_, size_)
+        : HAL_I2C_Mem_Read_IT(&hi2c1, device_, reg_, I2C_MEMADD_SIZE_8BIT, data_, size_);
+    // Not started, nothing to wait for
+    return status_ != HAL_OK;
+}
+
+void task_i2c::await_suspend(std::coroutine_handle<>) const noexcept
+{
+    TASKS_Suspend(deadline_, true, TASKS_EVENT_I2C);
+}
+
+HAL_StatusTypeDef task_i2c::await_resume() noexcept
+{
+    if (status_ != HAL_OK)
+        return status_;
+    if (!TASKS_I2CDone)
+    {
+        // The slave stopped answering half way, reset the peripheral and free the bus
+        ++TASKS_Stats.i2c_timeouts;
+        I2C_Recover();
+        return HAL_TIMEOUT;
+    }
+    return TASKS_I2CStatus;
+}
+
+static void TASKS_I2CComplete(I2C_HandleTypeDef* hi2c, HAL_StatusTypeDef status)
+{
+    if (hi2c != &hi2c1)
+        return;
+    TASKS_I2CStatus = status;
+    TASKS_I2CDone = true;
+    TASKS_Signal(TASKS_EVENT_I2C);
+}
+
+extern "C" void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    TASKS_I2CComplete(hi2c, HAL_OK);
+}
+
+extern "C" void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    TASKS_I2CComplete(hi2c, HAL_OK);
+}
+
+extern "C" void HAL_I2C_ErrorCallback(I2C_HandleTypeDef* hi2c)
+{
+    TASKS_I2CComplete(hi2c, HAL_ERROR);
+}
+
+extern "C" void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef* hi2c)
+{
+    TASKS_I2CComplete(hi2c, HAL_ERROR);
+}
@@ -0,0 +1,22 @@
+#include "telemetry.hpp"
+
+#include <inttypes.h>
+
+#include "console.h"
+#include "scrub.hpp"
+
+extern "C" const scrub_entry _sscrub[];
+extern "C" const scrub_entry _escrub[];
+
+void TELEMETRY_Dump()
+{
+    CONSOLE_Printf("%-24s %10s %10s %10s %10s\r\n", "variable", "primary", "replica", "all", "repairs");
+    for (const scrub_entry* entry = _sscrub; entry != _escrub; ++entry)
+    {
+        const telemetry_counters& counters = *entry->telemetry;
+        CONSOLE_Printf("%-24s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\r\n", entry->name,
+            counters.primary_invalid, counters.replica_used, counters.all_invalid, counters.repair_writes);
+    }
+    CONSOLE_Printf("scrub sweeps %" PRIu32 " repairs %" PRIu32 " lost %" PRIu32 "\r\n",
+        SCRUB_Stats.sweeps, SCRUB_Stats.repairs, SCRUB_Stats.lost);
+}
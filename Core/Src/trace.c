@@ -0,0 +1,55 @@
+#include "trace.h"
+
+#include <inttypes.h>
+
+#include "console.h"
+#include "dwt.h"
+
+// Actual defined in main.c, a DEBUG build never starts the watchdog
+extern IWDG_HandleTypeDef hiwdg;
+
+#define TRACE_MAGIC 0x7EACE000u
+
+__attribute__((section(".noinit"))) TRACE_Ring TRACE_Log;
+
+// The newest entry has to carry the sequence number the head says it has, the random RAM
+// of a power-on fails this. A record cut short by a reset leaves the head behind, so its
+// half written entry is never counted.
+static uint8_t TRACE_IsValid(void)
+{
+    if (TRACE_Log.magic != TRACE_MAGIC)
+        return 0;
+    if (TRACE_Log.head == 0)
+        return 1;
+    const uint32_t last = TRACE_Log.head - 1;
+    return (TRACE_Log.entries[last & (TRACE_ENTRIES - 1)].event >> 16) == (last & 0xFFFF);
+}
+
+void TRACE_Init(uint32_t reset_flags)
+{
+    if (!TRACE_IsValid())
+    {
+        TRACE_Log.head = 0;
+        TRACE_Log.magic = TRACE_MAGIC;
+    }
+    DWT_Enable();
+    TRACE_Record(reset_flags >> 24, TRACE_REASON_BOOT);
+}
+
+// Raw entries oldest first, one per line, for Tools/trace_decode.py. A full ring takes about
+// half a second at 115200 baud, longer than the watchdog allows, so it is fed on every line.
+void TRACE_Dump(void)
+{
+    const uint32_t head = TRACE_Log.head;
+    const uint32_t count = head < TRACE_ENTRIES ? head : TRACE_ENTRIES;
+    CONSOLE_Printf("trace %" PRIu32 " %" PRIu32 "\r\n", head, count);
+    for (uint32_t i = head - count; i != head; i++)
+    {
+        const TRACE_Entry* entry = &TRACE_Log.entries[i & (TRACE_ENTRIES - 1)];
+        CONSOLE_Printf("%08" PRIx32 " %08" PRIx32 "\r\n", entry->event, entry->cycles);
+#ifndef DEBUG
+        HAL_IWDG_Refresh(&hiwdg);
+#endif
+    }
+    CONSOLE_Printf("end\r\n");
+}
@@ -38,7 +38,7 @@ HAL_StatusTypeDef ZLG7290_Write(I2C_HandleTypeDef* hi2c, uint16_t addr, uint8_t*
         for (uint32_t j = 1; j <= bufsz; ++j)
         {
             status |= ZLG7290_WriteByte(hi2c, addr + bufsz - j, buf + bufsz - j);
-            HAL_Delay(5);
+            HAL_Delay(ZLG7290_WRITE_GAP_MS);
         }
         if (status == HAL_OK)
             break;
@@ -0,0 +1,95 @@
+// flash_journal over the NOR model of journal_flash_ram: appends across several compactions,
+// remounting, torn records and an interrupted compaction. Run by run.sh.
+#include "flash_journal.hpp"
+
+#include "host_test.hpp"
+
+constexpr uint32_t kSectorWords = 64;
+constexpr size_t kKeys = 3;
+using journal_t = flash_journal<kKeys>;
+
+static uint32_t sector0[kSectorWords];
+static uint32_t sector1[kSectorWords];
+
+// Programming fails once the budget is spent, as if the supply dropped half way
+static int program_budget = -1;
+
+static bool program_limited(volatile uint32_t* address, uint32_t word) noexcept
+{
+    if (program_budget == 0)
+        return false;
+    if (program_budget > 0)
+        --program_budget;
+    return journal_flash_ram::program(address, word);
+}
+
+static journal_flash flash()
+{
+    journal_flash f = journal_flash_ram::make(sector0, sector1, kSectorWords);
+    f.program = program_limited;
+    return f;
+}
+
+static bool holds(const journal_t& journal, uint32_t key, uint32_t expected)
+{
+    uint32_t value;
+    return journal.get(key, value) && value == expected;
+}
+
+int main()
+{
+    for (uint32_t& word : sector0)
+        word = 0;
+    for (uint32_t& word : sector1)
+        word = 0;
+
+    journal_t journal{ flash() };
+    expect(journal.mount() && journal.mounted(), "blank flash is formatted");
+    uint32_t value;
+    expect(!journal.get(0, value), "a new journal holds no key");
+
+    // 21 slots per sector, 200 appends compact many times over
+    for (uint32_t i = 0; i < 200; ++i)
+        expect(journal.set(i % kKeys, i), "append");
+    expect(journal.stats().compactions >= 8, "appends compacted several times");
+    expect(holds(journal, 0, 198) && holds(journal, 1, 199) && holds(journal, 2, 197), "newest values after compactions");
+
+    const uint32_t appends = journal.stats().appends;
+    journal.set(1, 199);
+    expect(journal.stats().appends == appends, "setting the value a key holds is skipped");
+
+    journal_t remounted{ flash() };
+    expect(remounted.mount(), "remount");
+    expect(holds(remounted, 0, 198) && holds(remounted, 1, 199) && holds(remounted, 2, 197), "newest values after remount");
+    expect(remounted.stats().mount_records <= kSectorWords / 3, "mount reads at most one sector");
+
+    // Supply lost after the key and value of a record, before its crc
+    if (remounted.free_slots() < 2)
+        remounted.set(0, 1000);
+    program_budget = 2;
+    expect(!remounted.set(2, 500), "torn append fails");
+    program_budget = -1;
+    journal_t after_torn{ flash() };
+    expect(after_torn.mount() && holds(after_torn, 2, 197), "torn record is ignored");
+    expect(after_torn.set(2, 501) && holds(after_torn, 2, 501), "append after a torn record");
+    journal_t after_append{ flash() };
+    expect(after_append.mount() && holds(after_append, 2, 501), "the dirty slot is skipped");
+
+    // Fill the sector and cut the compaction short before the new header
+    while (after_append.free_slots() > 0)
+        after_append.set(0, after_append.free_slots() + 2000);
+    uint32_t newest = 0;
+    after_append.get(0, newest);
+    program_budget = 3 * kKeys;
+    expect(!after_append.set(1, 600), "interrupted compaction fails");
+    program_budget = -1;
+    journal_t after_compaction{ flash() };
+    expect(after_compaction.mount() && holds(after_compaction, 0, newest) && holds(after_compaction, 2, 501),
+        "interrupted compaction leaves the old sector active");
+    expect(after_compaction.set(1, 601) && holds(after_compaction, 1, 601), "compaction completes on the next append");
+
+    journal_t last{ flash() };
+    expect(last.mount() && holds(last, 0, newest) && holds(last, 1, 601) && holds(last, 2, 501), "values after the finished compaction");
+
+    return finish();
+}
@@ -0,0 +1,22 @@
+// Shared harness of the host tests: expect() counts the failed checks, finish() reports
+// them and gives the exit code of main. Each test is a single translation unit.
+#pragma once
+
+#include <cstdio>
+
+static int failures;
+
+static void expect(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static int finish()
+{
+    std::printf("%d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
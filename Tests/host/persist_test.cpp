@@ -0,0 +1,62 @@
+// Restore path of persist_mirror over a plain array standing in for BKPSRAM. Run by run.sh.
+#include "persist.hpp"
+
+#include "host_test.hpp"
+
+using mirror_t = persist_mirror<3>;
+
+int main()
+{
+    volatile uint32_t region[mirror_t::region_words + 4] = {};
+    mirror_t mirror{ persist_region{ region, mirror_t::region_words } };
+    mirror_t::words_t words;
+
+    expect(mirror.attached(), "attached to a region of the right size");
+    expect(!mirror.load(words), "an empty region has no save");
+
+    mirror.save({ 1, 2, 3 });
+    expect(mirror.load(words) && words == mirror_t::words_t{ 1, 2, 3 }, "first save loads");
+    mirror.save({ 4, 5, 6 });
+    expect(mirror.load(words) && words == mirror_t::words_t{ 4, 5, 6 }, "newer save wins");
+
+    // The second save went to slot 1, the same words again must not touch either slot
+    const uint32_t sequence = region[mirror_t::slot_words + 1];
+    mirror.save({ 4, 5, 6 });
+    expect(region[mirror_t::slot_words + 1] == sequence && region[1] == sequence - 1, "same words are not saved again");
+
+    // A flipped bit in the newest slot falls back to the previous save
+    region[mirror_t::slot_words + 3] = region[mirror_t::slot_words + 3] ^ 0x10;
+    expect(mirror.load(words) && words == mirror_t::words_t{ 1, 2, 3 }, "corrupted newest slot falls back");
+
+    // Slot 1 was invalid, so this save overwrites it and slot 0 becomes the older one
+    mirror.save({ 7, 8, 9 });
+    expect(mirror.load(words) && words == mirror_t::words_t{ 7, 8, 9 }, "save after a corruption loads");
+    // A save into slot 0 cut short before its crc leaves the one in slot 1 restorable
+    region[1] = region[mirror_t::slot_words + 1] + 1;
+    region[2] = 10;
+    expect(mirror.load(words) && words == mirror_t::words_t{ 7, 8, 9 }, "torn save falls back to the previous one");
+
+    // Both slots gone
+    region[2] = region[2] ^ 1;
+    region[mirror_t::slot_words + 2] = region[mirror_t::slot_words + 2] ^ 1;
+    expect(!mirror.load(words), "no valid slot loads nothing");
+
+    // A mirror of another group size never loads these slots
+    mirror.erase();
+    mirror.save({ 1, 2, 3 });
+    persist_mirror<2> other{ persist_region{ region, mirror_t::region_words } };
+    persist_mirror<2>::words_t other_words;
+    expect(!other.load(other_words), "another layout does not load");
+
+    // Too small a region is never attached, nothing is written past it
+    volatile uint32_t small[mirror_t::region_words - 1] = {};
+    mirror_t undersized{ persist_region{ small, mirror_t::region_words - 1 } };
+    undersized.save({ 1, 2, 3 });
+    expect(!undersized.attached() && !undersized.load(words) && small[0] == 0, "undersized region stays unused");
+
+    // An offset past the end leaves nothing to attach to
+    mirror_t offset{ persist_region{ region, mirror_t::region_words }, mirror_t::region_words };
+    expect(!offset.attached(), "offset past the region");
+
+    return finish();
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Builds and runs every host test against the headers in Core/Inc, without the HAL.
+# Usage: sh Tests/host/run.sh, from anywhere. Exits non-zero on the first failure.
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$here/../.." && pwd)
+out=${TMPDIR:-/tmp}/stemp-host-tests
+mkdir -p "$out"
+for test in "$here"/*.cpp; do
+    name=$(basename "$test" .cpp)
+    ${CXX:-g++} -std=gnu++20 -O2 -Wall -Wextra -DCRITICAL_DATA_HOST -I"$root/Core/Inc" "$test" -o "$out/$name"
+    echo "== $name"
+    "$out/$name"
+done
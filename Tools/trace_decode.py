@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Decode the post-mortem state transition trace printed by the 'r' console command.
+
+Capture the USART1 output to a file, or pipe it in, and run
+    python3 Tools/trace_decode.py capture.txt
+Every entry is printed oldest first with the cycles since the entry before it, and the
+time when both entries ran on the same clock. The cycle counter runs on across reset
+jumps, a reset that reaches the clock tree is where the deltas start over.
+The tables below follow the enums in Core/Src/sm.cpp and Core/Inc/trace.h.
+"""
+
+import argparse
+import re
+import sys
+
+CORE_CLOCK_HZ = 168_000_000
+HSI_CLOCK_HZ = 16_000_000
+
+# TRACE_REASON_HSI, set in the reason field of entries made on the HSI
+REASON_HSI = 0x80
+
+STATES = [
+    "IS_EDITING",
+    "CHECK_TEMPTICK",
+    "READTEMP",
+    "IS_TEMP_IN_RANGE",
+    "TEMP_OUT_OF_RANGE",
+    "READ_KEY_INPUT",
+    "READ_KEY_DELAY",
+    "ON_KEY_PRESSED",
+    "UPDATE_KEYNUM",
+    "SWITCH_TARGET_LOW",
+    "SWITCH_TARGET_HIGH",
+    "MOVE_CURSOR_LEFT",
+    "MOVE_CURSOR_RIGHT",
+    "SWITCH_EDIT_MODE",
+    "SAVE_AND_EXIT_EDIT",
+    "UPDATE_DISPLAY",
+    "RESETHANDLER",
+]
+
+# Spawn order of SM_StartTasks
+TASKS = ["keypad", "display", "sensor", "alarm", "housekeeping"]
+
+REASONS = [
+    "boot",
+    "step",
+    "flow error",
+    "bad successor",
+    "task",
+    "rejuvenation",
+    "error handler",
+    "hard fault",
+]
+
+# RCC->CSR >> 24
+RESET_FLAGS = [
+    (1 << 1, "BOR"),
+    (1 << 2, "PIN"),
+    (1 << 3, "POR"),
+    (1 << 4, "SFT"),
+    (1 << 5, "IWDG"),
+    (1 << 6, "WWDG"),
+    (1 << 7, "LPWR"),
+]
+
+STATE_NONE = 0xFF
+
+
+def reset_flags(state):
+    return [flag for bit, flag in RESET_FLAGS if state & bit]
+
+
+def describe(state, reason):
+    name = REASONS[reason] if reason < len(REASONS) else f"reason {reason}"
+    if reason == 0:
+        return f"{name:<14} {'|'.join(reset_flags(state)) or 'reset jump'}"
+    if reason == 4:
+        return f"{name:<14} {TASKS[state] if state < len(TASKS) else state}"
+    if state == STATE_NONE:
+        return name
+    return f"{name:<14} {STATES[state] if state < len(STATES) else state}"
+
+
+def decode(lines):
+    header = None
+    entries = []
+    for line in lines:
+        line = line.strip()
+        match = re.fullmatch(r"trace (\d+) (\d+)", line)
+        if match:
+            header = int(match.group(1)), int(match.group(2))
+            entries = []
+            continue
+        match = re.fullmatch(r"([0-9a-f]{8}) ([0-9a-f]{8})", line)
+        if header and match:
+            entries.append((int(match.group(1), 16), int(match.group(2), 16)))
+    if header is None:
+        sys.exit("no trace header in the input")
+
+    head, count = header
+    if len(entries) != count:
+        print(f"warning: {len(entries)} of {count} entries received", file=sys.stderr)
+
+    previous = None
+    previous_clock = None
+    for index, (event, cycles) in enumerate(entries):
+        state = event & 0xFF
+        reason = (event >> 8) & 0x7F
+        clock = HSI_CLOCK_HZ if event >> 8 & REASON_HSI else CORE_CLOCK_HZ
+        sequence = event >> 16
+        expected = (head - count + index) & 0xFFFF
+        mark = "" if sequence == expected else "  (sequence mismatch, overwritten while dumping?)"
+        # A reset jump leaves the counter and the clock alone and its boot entry reads no
+        # reset flags. After a real reset the counter may have started over, and the cycles
+        # between two entries on different clocks have no single length.
+        if previous is None or (reason == 0 and reset_flags(state)):
+            delta = ""
+        else:
+            delta_cycles = (cycles - previous) & 0xFFFFFFFF
+            if clock == previous_clock:
+                delta = f"+{delta_cycles} ({delta_cycles * 1e6 / clock:.1f}us)"
+            else:
+                delta = f"+{delta_cycles} (clock switched)"
+        previous = cycles
+        previous_clock = clock
+        print(f"{sequence:5} {delta:>24}  {describe(state, reason)}{mark}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="console output, stdin if left out")
+    args = parser.parse_args()
+    if args.capture:
+        with open(args.capture, encoding="ascii", errors="replace") as capture:
+            decode(capture)
+    else:
+        decode(sys.stdin)
+
+
+if __name__ == "__main__":
+    main()